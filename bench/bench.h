@@ -0,0 +1,198 @@
+#ifndef MAGIO_BENCH_BENCH_H_
+#define MAGIO_BENCH_BENCH_H_
+
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <algorithm>
+
+#include "fmt/core.h"
+#include "fmt/format.h"
+
+#include "magio/core/wait_group.h"
+
+// A small harness for the benchmarks that track regressions between
+// releases: each case runs a number of samples of ops operations and
+// reports ns/op over the samples, as a table and optionally as JSON.
+//
+// usage: prog [--json FILE] [--filter TEXT] [--quick]
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// a WaitGroup released by the n-th done()
+struct Countdown {
+    Countdown(size_t n): left(n), wg(1) { }
+
+    void done() {
+        if (left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            wg.done();
+        }
+    }
+
+    std::atomic_size_t left;
+    magio::WaitGroup wg;
+};
+
+inline std::chrono::nanoseconds since(Clock::time_point begin) {
+    return Clock::now() - begin;
+}
+
+struct Stats {
+    double mean = 0;
+    double min = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+struct Result {
+    std::string name;
+    std::vector<std::pair<std::string, size_t>> params;
+    size_t ops;
+    size_t samples;
+    // of the samples
+    Stats ns_per_op;
+};
+
+class Suite {
+public:
+    Suite(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--quick") {
+                quick_ = true;
+            } else if (arg == "--json" && i + 1 < argc) {
+                json_path_ = argv[++i];
+            } else if (arg == "--filter" && i + 1 < argc) {
+                filter_ = argv[++i];
+            } else {
+                fmt::print(stderr, "usage: {} [--json FILE] [--filter TEXT] [--quick]\n", argv[0]);
+                std::exit(2);
+            }
+        }
+
+        fmt::print("{:<24} {:<20} {:>10} {:>10} {:>10} {:>10}  ns/op\n", "case", "params", "mean", "p50", "p99", "max");
+    }
+
+    // smaller runs, for a smoke test
+    bool quick() const {
+        return quick_;
+    }
+
+    // n, or n / 10 with --quick
+    size_t scale(size_t n) const {
+        return quick_ ? std::max(n / 10, size_t(1)) : n;
+    }
+
+    // sample() runs ops operations and returns how long they took, it
+    // runs once to warm up and then samples times. Setup inside sample()
+    // that should not count is left out of the duration it returns
+    template<typename Sample>
+    void run(std::string name, std::vector<std::pair<std::string, size_t>> params,
+        size_t ops, size_t samples, Sample&& sample)
+    {
+        auto label = format_params(params);
+        if (!filter_.empty() && (name + " " + label).find(filter_) == std::string::npos) {
+            return;
+        }
+
+        samples = std::max(samples, size_t(1));
+        sample(ops);
+
+        std::vector<double> ns;
+        ns.reserve(samples);
+        for (size_t i = 0; i < samples; ++i) {
+            ns.push_back((double)std::chrono::nanoseconds(sample(ops)).count() / ops);
+        }
+
+        Result result{std::move(name), std::move(params), ops, samples, stats(ns)};
+        auto& s = result.ns_per_op;
+        fmt::print("{:<24} {:<20} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+            result.name, label, s.mean, s.p50, s.p99, s.max);
+        std::fflush(stdout);
+        results_.push_back(std::move(result));
+    }
+
+    // writes the JSON file if one was asked for, returns the exit code
+    int finish() const {
+        if (json_path_.empty()) {
+            return 0;
+        }
+
+        auto file = std::fopen(json_path_.c_str(), "w");
+        if (!file) {
+            fmt::print(stderr, "can't open {}\n", json_path_);
+            return 1;
+        }
+
+        std::time_t now = std::time(nullptr);
+        char date[32];
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        fmt::print(file, "{{\n  \"date\": \"{}\",\n  \"quick\": {},\n  \"results\": [", date, quick_);
+
+        for (size_t i = 0; i < results_.size(); ++i) {
+            auto& r = results_[i];
+            auto& s = r.ns_per_op;
+            fmt::print(file, "{}\n    {{\"name\": \"{}\", \"params\": {{", i == 0 ? "" : ",", r.name);
+            for (size_t j = 0; j < r.params.size(); ++j) {
+                fmt::print(file, "{}\"{}\": {}", j == 0 ? "" : ", ", r.params[j].first, r.params[j].second);
+            }
+            fmt::print(file,
+                "}}, \"ops\": {}, \"samples\": {}, \"ns_per_op\": "
+                "{{\"mean\": {:.2f}, \"min\": {:.2f}, \"p50\": {:.2f}, \"p90\": {:.2f}, \"p99\": {:.2f}, \"max\": {:.2f}}}}}",
+                r.ops, r.samples, s.mean, s.min, s.p50, s.p90, s.p99, s.max);
+        }
+
+        fmt::print(file, "\n  ]\n}}\n");
+        bool ok = std::fclose(file) == 0;
+        if (!ok) {
+            fmt::print(stderr, "can't write {}\n", json_path_);
+        }
+        return ok ? 0 : 1;
+    }
+
+private:
+    static std::string format_params(const std::vector<std::pair<std::string, size_t>>& params) {
+        std::string res;
+        for (auto& [key, value] : params) {
+            res += fmt::format("{}{}={}", res.empty() ? "" : " ", key, value);
+        }
+        return res;
+    }
+
+    static Stats stats(std::vector<double>& ns) {
+        std::sort(ns.begin(), ns.end());
+        auto at = [&](double q) {
+            return ns[std::min(ns.size() - 1, (size_t)(q * (ns.size() - 1) + 0.5))];
+        };
+
+        Stats s;
+        for (double v : ns) {
+            s.mean += v;
+        }
+        s.mean /= ns.size();
+        s.min = ns.front();
+        s.p50 = at(0.5);
+        s.p90 = at(0.9);
+        s.p99 = at(0.99);
+        s.max = ns.back();
+        return s;
+    }
+
+    bool quick_ = false;
+    std::string json_path_;
+    std::string filter_;
+    std::vector<Result> results_;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include <future>
+#include <thread>
+#include <vector>
+#include <optional>
+
+#include "bench.h"
+
+#include "magio/core/logger.h"
+#include "magio/core/promise.h"
+#include "magio/core/thread_pool.h"
+#include "magio/core/loop_executor.h"
+
+using namespace std;
+using namespace magio;
+using namespace bench;
+
+// The regression suite: promises, executors, timers and the logger, with
+// std::async / std::future as the baseline where they do the same thing.
+// --json FILE keeps the numbers for comparing releases
+
+constexpr size_t kThreads = 4;
+
+// spawn() a promise that resolves on the pool, n times
+void spawn_resolve(Suite& suite, StaticThreadPool& pool) {
+    size_t n = suite.scale(100'000);
+    suite.run("spawn_resolve", {}, n, 20, [&](size_t n) {
+        Countdown cd(n);
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            Promise<>::spawn(&pool, [&cd](Defer<> defer) {
+                defer.resolve();
+                cd.done();
+            });
+        }
+        cd.wg.wait();
+        return since(begin);
+    });
+
+    // a thread per task, so far fewer of them
+    n = suite.scale(1000);
+    suite.run("spawn_resolve/std_async", {}, n, 20, [](size_t n) {
+        vector<future<void>> futures;
+        futures.reserve(n);
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            futures.push_back(async(launch::async, [] { }));
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+        return since(begin);
+    });
+}
+
+// from resolving the head of a then() chain outside the pool to its tail running
+void chain_latency(Suite& suite, StaticThreadPool& pool) {
+    for (size_t depth : {1, 10, 100, 1000}) {
+        suite.run("then_chain", {{"depth", depth}}, 1, suite.quick() ? 20 : 200, [&](size_t) {
+            promise<Defer<>> head_defer;
+            auto tail = Promise<>::spawn(&pool, [&](Defer<> defer) {
+                head_defer.set_value(defer);
+            });
+            for (size_t i = 0; i < depth; ++i) {
+                tail = tail->then([] { });
+            }
+
+            WaitGroup wg(1);
+            Clock::time_point end;
+            tail->then([&] {
+                end = Clock::now();
+                wg.done();
+            });
+
+            auto defer = head_defer.get_future().get();
+            auto begin = Clock::now();
+            defer.resolve();
+            wg.wait();
+            return chrono::nanoseconds(end - begin);
+        });
+    }
+}
+
+// the same on a LoopExecutor, built and run on this thread
+void loop_chain_latency(Suite& suite) {
+    for (size_t depth : {1, 10, 100, 1000}) {
+        suite.run("then_chain/loop", {{"depth", depth}}, 1, suite.quick() ? 20 : 200, [&](size_t) {
+            LoopExecutor loop;
+            optional<Defer<>> head_defer;
+            auto tail = Promise<>::spawn(&loop, [&](Defer<> defer) {
+                head_defer = defer;
+            });
+            for (size_t i = 0; i < depth; ++i) {
+                tail = tail->then([] { });
+            }
+            tail->then([&] { loop.stop(); });
+            loop.poll();
+
+            auto begin = Clock::now();
+            head_defer->resolve();
+            loop.run();
+            return since(begin);
+        });
+    }
+}
+
+// n inputs resolving on the pool into all() or race(), ns per input
+void fan_in(Suite& suite, StaticThreadPool& pool) {
+    size_t max_inputs = suite.quick() ? 10'000 : 100'000;
+    for (size_t n = 10; n <= max_inputs; n *= 10) {
+        size_t samples = clamp<size_t>(1'000'000 / n, 5, 200);
+        if (suite.quick()) {
+            samples = 5;
+        }
+
+        for (bool all : {true, false}) {
+            suite.run(all ? "all" : "race", {{"inputs", n}}, n, samples, [&, all](size_t n) {
+                vector<PromisePtr<int>> inputs;
+                inputs.reserve(n);
+                WaitGroup wg(1);
+
+                auto begin = Clock::now();
+                for (size_t i = 0; i < n; ++i) {
+                    inputs.push_back(Promise<int>::spawn(&pool, [i](Defer<int> defer) {
+                        defer.resolve((int)i);
+                    }));
+                }
+                if (all) {
+                    Promise<>::all(&pool, inputs)->then([&](vector<int>) { wg.done(); });
+                } else {
+                    Promise<>::race(&pool, inputs)->then([&] { wg.done(); });
+                }
+                wg.wait();
+                auto elapsed = since(begin);
+
+                // race() has settled before the others have, let them finish
+                // so they don't run into the next sample
+                if (!all) {
+                    WaitGroup settled(1);
+                    Promise<>::all_settled(&pool, inputs)->then([&](auto&&) { settled.done(); });
+                    settled.wait();
+                }
+                return elapsed;
+            });
+        }
+
+        if (n > 1000) {
+            continue;
+        }
+        suite.run("all/std_async", {{"inputs", n}}, n, suite.quick() ? 5 : 20, [](size_t n) {
+            vector<future<int>> inputs;
+            inputs.reserve(n);
+            auto begin = Clock::now();
+            for (size_t i = 0; i < n; ++i) {
+                inputs.push_back(async(launch::async, [i] { return (int)i; }));
+            }
+            vector<int> values;
+            values.reserve(n);
+            for (auto& f : inputs) {
+                values.push_back(f.get());
+            }
+            return since(begin);
+        });
+    }
+}
+
+// post() from threads outside the pool until the pool has run every task
+void post_throughput(Suite& suite, StaticThreadPool& pool) {
+    size_t n = suite.scale(1'000'000);
+    for (size_t producers : {1, 2, 4, 8, 16, 32, 64}) {
+        suite.run("post", {{"producers", producers}}, n, suite.quick() ? 3 : 10, [&](size_t n) {
+            Countdown cd(n);
+            vector<thread> threads;
+            threads.reserve(producers);
+
+            auto begin = Clock::now();
+            for (size_t p = 0; p < producers; ++p) {
+                size_t count = n / producers + (p < n % producers ? 1 : 0);
+                threads.emplace_back([&pool, &cd, count] {
+                    for (size_t i = 0; i < count; ++i) {
+                        pool.post([&cd] { cd.done(); });
+                    }
+                });
+            }
+            for (auto& th : threads) {
+                th.join();
+            }
+            cd.wg.wait();
+            return since(begin);
+        });
+    }
+}
+
+void timers(Suite& suite, StaticThreadPool& pool) {
+    size_t n = suite.scale(100'000);
+    vector<TimerHandle> handles(n);
+
+    // far timers, like request timeouts that rarely fire
+    auto insert = [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            handles[i] = pool.expires_after(chrono::hours(1) + chrono::microseconds(i), [](bool) { });
+        }
+    };
+
+    suite.run("timer_insert", {}, n, 10, [&](size_t n) {
+        auto begin = Clock::now();
+        insert(n);
+        auto elapsed = since(begin);
+        for (size_t i = 0; i < n; ++i) {
+            pool.cancel(handles[i]);
+        }
+        return elapsed;
+    });
+
+    suite.run("timer_cancel", {}, n, 10, [&](size_t n) {
+        insert(n);
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            pool.cancel(handles[i]);
+        }
+        return since(begin);
+    });
+
+    // n timers due at the same time, from the deadline to the last callback
+    suite.run("timer_fire", {}, n, 10, [&](size_t n) {
+        Countdown cd(n);
+        auto deadline = TimerClock::now() + chrono::milliseconds(100);
+        for (size_t i = 0; i < n; ++i) {
+            pool.expires_until(deadline, [&cd](bool) { cd.done(); });
+        }
+        cd.wg.wait();
+        return chrono::nanoseconds(max(TimerClock::now() - deadline, TimerClock::duration::zero()));
+    });
+}
+
+class NullSink: public LogSink {
+public:
+    void write(string_view) override { }
+
+    void flush() override { }
+};
+
+// the cost on the calling thread, Logger::write() behind M_INFO
+void logger(Suite& suite) {
+    size_t n = suite.scale(1'000'000);
+    auto write = [](size_t n) {
+        auto begin = Clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            M_INFO("request {} took {} us on {}", i, 42.5, "worker");
+        }
+        return since(begin);
+    };
+
+    Logger::set_level(LogLevel::Warn);
+    suite.run("log_write/filtered", {}, n, 10, write);
+    Logger::set_level(LogLevel::Info);
+    suite.run("log_write/sync", {}, n, 10, write);
+
+    // the logger can't go back to sync, so this comes last
+    Logger::set_async();
+    suite.run("log_write/async", {}, n, 10, write);
+    Logger::flush();
+}
+
+int main(int argc, char** argv) {
+    Suite suite(argc, argv);
+
+    // before any thread logs, the pool's workers do
+    Logger::add_sink(make_shared<NullSink>());
+
+    StaticThreadPool pool(kThreads);
+    pool.start();
+
+    spawn_resolve(suite, pool);
+    chain_latency(suite, pool);
+    loop_chain_latency(suite);
+    fan_in(suite, pool);
+    post_throughput(suite, pool);
+    timers(suite, pool);
+    pool.destroy();
+
+    logger(suite);
+    return suite.finish();
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "fmt/core.h"
+
+#include <memory>
+#include <numeric>
+
+#include "magio/core/topology.h"
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+
+// Chains of tasks that each walk a buffer, written first by the
+// chain's first task, so the pages live on that task's node. A chain
+// that stays on the node finds them in its caches and local memory,
+// one that bounces between nodes pays for remote reads at every hop
+
+constexpr size_t kChains = 64;
+constexpr size_t kDepth = 100;
+constexpr size_t kChainBytes = 512 * 1024;
+
+struct Countdown {
+    Countdown(size_t n): left(n), wg(1) { }
+
+    void done() {
+        if (left.fetch_sub(1, memory_order_acq_rel) == 1) {
+            wg.done();
+        }
+    }
+
+    atomic_size_t left;
+    WaitGroup wg;
+};
+
+struct Chain {
+    void operator()() {
+        if (!data) {
+            data = make_unique<uint64_t[]>(kChainBytes / sizeof(uint64_t));
+        }
+
+        auto begin = data.get();
+        auto end = begin + kChainBytes / sizeof(uint64_t);
+        uint64_t sum = accumulate(begin, end, uint64_t(0));
+        for (auto p = begin; p != end; p += 8) {
+            *p += sum;
+        }
+
+        if (++step == kDepth) {
+            cd->done();
+            return;
+        }
+        // the next hop goes to the next pool, the same one if there is one
+        pools[step % pools.size()]->post(move(*this));
+    }
+
+    vector<Executor*> pools;
+    Countdown* cd;
+    unique_ptr<uint64_t[]> data;
+    size_t step = 0;
+};
+
+double run_chains(vector<Executor*> pools) {
+    Countdown cd(kChains);
+
+    auto begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < kChains; ++i) {
+        pools[0]->post(Chain{pools, &cd, {}});
+    }
+    cd.wg.wait();
+    auto end = chrono::steady_clock::now();
+
+    return (double)chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / (kChains * kDepth);
+}
+
+int main() {
+    auto& nodes = numa_nodes();
+    fmt::print("{} NUMA node(s)\n", nodes.size());
+
+    // a pool pinned to each of the first two nodes, or two on the only one
+    auto& first = nodes[0];
+    auto& second = nodes.size() > 1 ? nodes[1] : nodes[0];
+    size_t threads = min(first.size(), second.size());
+
+    StaticThreadPool near(threads - 1, Placement{{first}});
+    StaticThreadPool far(threads - 1, Placement{{second}});
+    near.start();
+    far.start();
+
+    double local = run_chains({&near});
+    double bouncing = run_chains({&near, &far});
+    near.destroy();
+    far.destroy();
+
+    // every node in one pool, a chain stays in the group it started in
+    size_t all = 0;
+    for (auto& cpus : nodes) {
+        all += cpus.size();
+    }
+    StaticThreadPool grouped(all - 1, Placement::numa());
+    grouped.start();
+    double numa = run_chains({&grouped});
+    grouped.destroy();
+
+    fmt::print("{:<24} {:>10.1f} ns/hop\n", "same node", local);
+    fmt::print("{:<24} {:>10.1f} ns/hop\n", "across nodes", bouncing);
+    fmt::print("{:<24} {:>10.1f} ns/hop\n", "numa groups", numa);
+}
\ No newline at end of file
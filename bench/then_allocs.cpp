@@ -0,0 +1,67 @@
+#include <new>
+#include <cstdlib>
+
+#include "fmt/core.h"
+
+#include "magio/core/promise.h"
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+using namespace chrono_literals;
+
+// Counts heap allocations made while a chain of then() is built and run
+
+static atomic_size_t allocations = 0;
+
+// noinline keeps gcc from matching the malloc against sized deletes
+[[gnu::noinline]] void* operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+constexpr size_t kDepth = 10000;
+
+void run_chain(StaticThreadPool& pool, size_t round) {
+    WaitGroup wg(1);
+    auto payload = make_shared<int>(0);
+
+    size_t before = allocations.load();
+    auto p = sleep_for(&pool, 200ms);
+    for (size_t i = 0; i < kDepth; ++i) {
+        // a typical continuation: some shared state plus a few words
+        p = p->then([payload, i, j = i * 2, k = i * 3] {
+            *payload += (int)(i + j + k) & 1;
+        });
+    }
+    size_t registered = allocations.load();
+
+    p->then([&wg] {
+        wg.done();
+    });
+    wg.wait();
+    size_t settled = allocations.load();
+
+    fmt::print("round {} then() allocations: {:.2f} to register, {:.2f} in total\n",
+        round,
+        (double)(registered - before) / kDepth,
+        (double)(settled - before) / kDepth);
+}
+
+int main() {
+    StaticThreadPool pool(4);
+    pool.start();
+
+    // the first round fills the promise pools, later rounds reuse them
+    for (size_t round = 1; round <= 3; ++round) {
+        run_chain(pool, round);
+    }
+}
\ No newline at end of file
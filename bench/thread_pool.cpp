@@ -0,0 +1,202 @@
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "fmt/core.h"
+
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+
+// Baseline is the pool from before work stealing, one mutex and deque
+// for every post. Global sends every post, from workers too, through the
+// group's shared lock free inject queue, WorkStealing keeps a worker's
+// posts in its own deque. Every benchmark runs on all three with the same
+// thread count
+
+constexpr size_t kThreads = 16;
+
+// the original StaticThreadPool without its timers, thread_num + 1 workers
+// taking tasks from one deque under one mutex
+class BaselinePool: public Executor {
+public:
+    explicit BaselinePool(size_t thread_num) {
+        for (size_t i = 0; i < thread_num + 1; ++i) {
+            threads_.emplace_back([this] { run_in_background(); });
+        }
+    }
+
+    ~BaselinePool() {
+        {
+            lock_guard lk(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& th : threads_) {
+            th.join();
+        }
+    }
+
+    using Executor::post;
+
+    void post(Task&& task) override {
+        {
+            lock_guard lk(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+    // not benchmarked
+    TimerHandle expires_until(const TimerClock::time_point&, TimerTask&&) override {
+        return {};
+    }
+
+    bool cancel(TimerHandle) override {
+        return false;
+    }
+
+private:
+    void run_in_background() {
+        Task task;
+        for (; ;) {
+            {
+                unique_lock lk(mutex_);
+                cv_.wait(lk, [this] {
+                    return !tasks_.empty() || stop_;
+                });
+                if (stop_) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    mutex mutex_;
+    condition_variable cv_;
+    deque<Task> tasks_;
+    bool stop_ = false;
+    vector<thread> threads_;
+};
+
+struct Countdown {
+    Countdown(size_t n): left(n), wg(1) { }
+
+    void done() {
+        if (left.fetch_sub(1, memory_order_acq_rel) == 1) {
+            wg.done();
+        }
+    }
+
+    atomic_size_t left;
+    WaitGroup wg;
+};
+
+template<typename Fn>
+double measure(Executor& pool, size_t ops, Fn&& fn) {
+    auto begin = chrono::steady_clock::now();
+    fn(pool);
+    auto end = chrono::steady_clock::now();
+
+    return (double)chrono::duration_cast<chrono::nanoseconds>(end - begin).count() / ops;
+}
+
+// producer threads outside the pool, like I/O or timer threads
+void external_post(Executor& pool, size_t n, size_t producers) {
+    Countdown cd(n);
+    vector<thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&pool, &cd, count = n / producers] {
+            for (size_t i = 0; i < count; ++i) {
+                pool.post([&cd] { cd.done(); });
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    cd.wg.wait();
+}
+
+// the same, handing kPostBatchSize tasks at a time to post_bulk()
+void external_post_bulk(Executor& pool, size_t n) {
+    Countdown cd(n);
+    Task tasks[kPostBatchSize];
+    for (size_t i = 0; i < n; i += kPostBatchSize) {
+        for (auto& task : tasks) {
+            task = [&cd] { cd.done(); };
+        }
+        pool.post_bulk(tasks);
+    }
+    cd.wg.wait();
+}
+
+// every task posts its successor from inside the pool, which is what
+// Promise::resolve_impl does for continuations
+void chained_post(Executor& pool, size_t chains, size_t depth) {
+    Countdown cd(chains);
+
+    struct Step {
+        void operator()() {
+            if (--left == 0) {
+                cd->done();
+                return;
+            }
+            pool->post(Step{*this});
+        }
+
+        Executor* pool;
+        Countdown* cd;
+        size_t left;
+    };
+
+    for (size_t i = 0; i < chains; ++i) {
+        pool.post(Step{&pool, &cd, depth});
+    }
+    cd.wg.wait();
+}
+
+template<typename Fn>
+void compare(const char* name, size_t ops, Fn&& fn) {
+    double baseline;
+    {
+        BaselinePool pool(kThreads);
+        baseline = measure(pool, ops, fn);
+    }
+
+    auto measure_schedule = [&](StaticThreadPool::Schedule schedule) {
+        StaticThreadPool pool(kThreads, schedule);
+        pool.start();
+        return measure(pool, ops, fn);
+    };
+    double global = measure_schedule(StaticThreadPool::Global);
+    double stealing = measure_schedule(StaticThreadPool::WorkStealing);
+
+    fmt::print("{:<24} baseline {:>8.1f} ns/op   global {:>8.1f} ns/op   work stealing {:>8.1f} ns/op\n",
+        name, baseline, global, stealing);
+}
+
+int main() {
+    compare("external post", 1'000'000, [](Executor& pool) {
+        external_post(pool, 1'000'000, 1);
+    });
+
+    compare("external post x4", 1'000'000, [](Executor& pool) {
+        external_post(pool, 1'000'000, 4);
+    });
+
+    compare("external post_bulk", 1'000'000, [](Executor& pool) {
+        external_post_bulk(pool, 1'000'000);
+    });
+
+    compare("chained post", 1'000'000, [](Executor& pool) {
+        chained_post(pool, 1000, 1000);
+    });
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <ctime>
+#include <random>
+#include <algorithm>
+
+#include "fmt/core.h"
+
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+
+// Idle CPU and firing jitter of the timer poller while 100k far
+// timers are pending, like request timeouts that rarely fire
+
+constexpr size_t kThreads = 4;
+constexpr size_t kPending = 100'000;
+constexpr size_t kFired = 1000;
+
+double cpu_seconds() {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main() {
+    StaticThreadPool pool(kThreads);
+    pool.start();
+
+    for (size_t i = 0; i < kPending; ++i) {
+        pool.expires_after(chrono::hours(1) + chrono::milliseconds(i), [](bool) { });
+    }
+
+    auto cpu_begin = cpu_seconds();
+    this_thread::sleep_for(chrono::seconds(1));
+    fmt::print("idle cpu with {} pending timers: {:.1f}%\n", kPending, (cpu_seconds() - cpu_begin) * 100);
+
+    // deadlines spread over one second, lateness measured in the callback
+    mt19937 rng(1);
+    vector<double> lateness(kFired);
+    WaitGroup wg(kFired);
+    auto now = TimerClock::now();
+    for (size_t i = 0; i < kFired; ++i) {
+        auto deadline = now + chrono::microseconds(rng() % 1'000'000);
+        pool.expires_until(deadline, [&, i, deadline](bool) {
+            lateness[i] = (double)chrono::duration_cast<chrono::microseconds>(TimerClock::now() - deadline).count();
+            wg.done();
+        });
+    }
+    wg.wait();
+
+    sort(lateness.begin(), lateness.end());
+    fmt::print("lateness of {} timers: p50 {:.0f}us p99 {:.0f}us max {:.0f}us\n",
+        kFired, lateness[kFired / 2], lateness[kFired * 99 / 100], lateness.back());
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "magio/core/logger.h"
+#include "magio/core/coroutine.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+using namespace chrono_literals;
+
+#if defined(__cpp_impl_coroutine)
+
+PromisePtr<int> fetch(Executor* exe, int n) {
+    co_return co_await Promise<int>::spawn(exe, [n](Defer<int> defer) {
+        this_thread::sleep_for(1s);
+        defer.resolve(n * 2);
+    });
+}
+
+PromisePtr<> coroutine_chain(StaticThreadPool* pool) {
+    co_await sleep_for(pool, 1s);
+    M_INFO("{}", "after 1s");
+
+    int n = co_await fetch(pool, 21);
+    M_INFO("got {}", n);
+
+    try {
+        co_await Promise<>::reject(pool, make_exception_ptr(runtime_error("something error happened")));
+    } catch(const exception& e) {
+        M_ERROR("{}", e.what());
+    }
+}
+
+int main() {
+    StaticThreadPool pool(8);
+
+    coroutine_chain(&pool);
+
+    pool.start();
+    pool.wait_for(3s);
+}
+
+#else
+
+int main() {
+    M_WARN("{}", "configure with --coroutine=y to build the coroutine example");
+}
+
+#endif
\ No newline at end of file
@@ -9,14 +9,14 @@ using namespace chrono_literals;
 void promise_chain() {
     StaticThreadPool pool(8);
 
-    Promise::spawn(&pool, [](Defer defer) {
+    Promise<>::spawn(&pool, [](Defer<> defer) {
         this_thread::sleep_for(1s);
         M_INFO("{}", "after 1s");
         defer.resolve();
     })->then([&] {
         this_thread::sleep_for(1s);
         M_INFO("{}", "after 1s");
-        return Promise::reject(&pool);
+        return Promise<>::reject(&pool);
     })->then([] {
         this_thread::sleep_for(1s);
         M_INFO("{}", "after 1s");
@@ -31,25 +31,25 @@ void promise_chain() {
 void promise_all() {
     StaticThreadPool pool(8);
 
-    vector<PromisePtr> vec {
-        Promise::spawn(&pool, [](Defer defer) {
+    vector<PromisePtr<>> vec {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(2s);
             M_INFO("{}", "task one completed");
             defer.resolve();
         }),
-        Promise::spawn(&pool, [](Defer defer) {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(1s);
             M_INFO("{}", "task two completed");
             defer.resolve();
         }),
-        Promise::spawn(&pool, [](Defer defer) {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(3s);
             M_INFO("{}", "task three completed");
             defer.resolve();
         }),
     };
 
-    Promise::all(&pool, vec)->then([] {
+    Promise<>::all(&pool, vec)->then([] {
         M_INFO("{}", "all tasks completed");
     })->fail([] {
         M_INFO("{}", "at least one task failed");
@@ -62,25 +62,25 @@ void promise_all() {
 void promise_race() {
     StaticThreadPool pool(8);
 
-    vector<PromisePtr> vec {
-        Promise::spawn(&pool, [](Defer defer) {
+    vector<PromisePtr<>> vec {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(2s);
             M_INFO("{}", "task one completed");
             defer.resolve();
         }),
-        Promise::spawn(&pool, [](Defer defer) {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(1s);
             M_INFO("{}", "task two completed");
             defer.resolve();
         }),
-        Promise::spawn(&pool, [](Defer defer) {
+        Promise<>::spawn(&pool, [](Defer<> defer) {
             this_thread::sleep_for(3s);
             M_INFO("{}", "task three completed");
             defer.resolve();
         }),
     };
 
-    Promise::race(&pool, vec)->then([] {
+    Promise<>::race(&pool, vec)->then([] {
         M_INFO("{}", "one task complete");
     })->fail([] {
         M_INFO("{}", "at least one task failed");
@@ -101,11 +101,35 @@ void promise_timer() {
     pool.wait_for(3s);
 }
 
+void promise_value() {
+    StaticThreadPool pool(8);
+
+    Promise<int>::spawn(&pool, [](Defer<int> defer) {
+        this_thread::sleep_for(1s);
+        defer.resolve(42);
+    })->then([](int n) {
+        M_INFO("got {}", n);
+        return to_string(n);
+    })->then([](string str) {
+        throw runtime_error("can't handle " + str);
+    })->fail([](exception_ptr eptr) {
+        try {
+            rethrow_exception(eptr);
+        } catch(const exception& e) {
+            M_ERROR("{}", e.what());
+        }
+    });
+
+    pool.start();
+    pool.wait_for(2s);
+}
+
 int main() {
     promise_chain();
     promise_all();
     promise_race();
     promise_timer();
+    promise_value();
 
     MAGIO_MEMORY_CHECK;
 }
\ No newline at end of file
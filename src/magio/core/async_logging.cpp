@@ -0,0 +1,115 @@
+#include "magio/core/async_logging.h"
+
+#include <utility>
+
+namespace magio {
+
+AsyncLogging::AsyncLogging(LogSink& sink, std::chrono::milliseconds flush_interval, LogOverflow overflow)
+    : sink_(sink)
+    , flush_interval_(flush_interval)
+    , overflow_(overflow)
+    , current_(std::make_unique<Buffer>())
+{
+    free_.push_back(std::make_unique<Buffer>());
+    thread_ = std::thread(&AsyncLogging::run, this);
+}
+
+AsyncLogging::~AsyncLogging() {
+    {
+        std::lock_guard lk(m_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void AsyncLogging::append(std::string_view record) {
+    record = record.substr(0, kLargeBufferSize);
+
+    std::unique_lock lk(m_);
+    for (; ;) {
+        if (current_->rest() >= record.size()) {
+            current_->append(record);
+            return;
+        }
+
+        if (full_.size() < kMaxPendingLogBuffers) {
+            full_.push_back(std::move(current_));
+            current_ = take_free_buffer();
+            cv_.notify_one();
+            continue;
+        }
+
+        if (overflow_ == LogOverflow::Drop) {
+            ++dropped_;
+            return;
+        }
+        written_cv_.wait(lk);
+    }
+}
+
+void AsyncLogging::flush() {
+    std::unique_lock lk(m_);
+    auto ticket = ++flush_requested_;
+    cv_.notify_one();
+    written_cv_.wait(lk, [this, ticket] {
+        return written_ >= ticket;
+    });
+}
+
+std::unique_ptr<AsyncLogging::Buffer> AsyncLogging::take_free_buffer() {
+    if (free_.empty()) {
+        return std::make_unique<Buffer>();
+    }
+
+    auto buffer = std::move(free_.back());
+    free_.pop_back();
+    return buffer;
+}
+
+void AsyncLogging::run() {
+    std::vector<std::unique_ptr<Buffer>> writing;
+    std::unique_lock lk(m_);
+
+    for (; ;) {
+        cv_.wait_for(lk, flush_interval_, [this] {
+            return stop_ || !full_.empty() || flush_requested_ != written_;
+        });
+
+        // everything appended up to here goes out in this round
+        auto ticket = flush_requested_;
+        writing.swap(full_);
+        if (current_->size() > 0) {
+            writing.push_back(std::move(current_));
+            current_ = take_free_buffer();
+        }
+        auto dropped = std::exchange(dropped_, 0);
+        lk.unlock();
+
+        for (auto& buffer : writing) {
+            sink_.write(buffer->str_view());
+            buffer->clear();
+        }
+        if (dropped > 0) {
+            sink_.write(fmt::format("{} log records dropped\n", dropped));
+        }
+        sink_.flush();
+
+        lk.lock();
+        // two spares cover the usual swap, the rest is freed
+        for (auto& buffer : writing) {
+            if (free_.size() < 2) {
+                free_.push_back(std::move(buffer));
+            }
+        }
+        writing.clear();
+        written_ = ticket;
+        written_cv_.notify_all();
+
+        if (stop_ && full_.empty() && current_->size() == 0) {
+            return;
+        }
+    }
+}
+
+}
\ No newline at end of file
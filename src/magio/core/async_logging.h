@@ -0,0 +1,77 @@
+#ifndef MAGIO_CORE_ASYNC_LOGGING_H_
+#define MAGIO_CORE_ASYNC_LOGGING_H_
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "magio/core/log_sink.h"
+#include "magio/core/noncopyable.h"
+#include "magio/core/static_buffer.h"
+
+namespace magio {
+
+// what append() does when every buffer is waiting to be written
+enum class LogOverflow {
+    // the record is dropped and counted
+    Drop,
+    // the caller waits for the background thread
+    Block
+};
+
+constexpr std::chrono::milliseconds kLogFlushInterval{1000};
+// buffers that may be full and waiting for the background thread
+constexpr size_t kMaxPendingLogBuffers = 8;
+
+// Double buffered backend. Records are appended to a shared front buffer,
+// the background thread swaps out the full ones, and the partly filled one
+// once per flush interval, and hands each to the sink with a single call
+class AsyncLogging: Noncopyable {
+    using Buffer = detail::LargeBuffer;
+
+public:
+    // sink is only used by the background thread and must outlive this
+    AsyncLogging(LogSink& sink, std::chrono::milliseconds flush_interval, LogOverflow overflow);
+
+    // writes what has been appended
+    ~AsyncLogging();
+
+    void append(std::string_view record);
+
+    // returns once everything appended before the call has been written
+    void flush();
+
+private:
+    void run();
+
+    std::unique_ptr<Buffer> take_free_buffer();
+
+    LogSink& sink_;
+    std::chrono::milliseconds flush_interval_;
+    LogOverflow overflow_;
+
+    std::mutex m_;
+    // wakes the background thread
+    std::condition_variable cv_;
+    // wakes blocked appenders and flush()
+    std::condition_variable written_cv_;
+
+    std::unique_ptr<Buffer> current_;
+    std::vector<std::unique_ptr<Buffer>> full_;
+    std::vector<std::unique_ptr<Buffer>> free_;
+    size_t dropped_ = 0;
+
+    // flush() waits until written_ catches up with the flush_requested_ it saw
+    size_t flush_requested_ = 0;
+    size_t written_ = 0;
+    bool stop_ = false;
+
+    std::thread thread_;
+};
+
+}
+
+#endif
\ No newline at end of file
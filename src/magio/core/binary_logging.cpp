@@ -0,0 +1,187 @@
+#include "magio/core/binary_logging.h"
+
+#include "magio/core/current_thread.h"
+
+namespace magio {
+
+namespace {
+
+template<typename T>
+void put(std::vector<char>& out, T value) {
+    auto p = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+void put(std::vector<char>& out, std::string_view sv) {
+    put(out, (uint32_t)sv.size());
+    out.insert(out.end(), sv.begin(), sv.end());
+}
+
+}
+
+BinaryLogging::BinaryLogging(const char* path, std::chrono::milliseconds poll_interval, LogOverflow overflow)
+    : file_(std::fopen(path, "wb"))
+    , poll_interval_(poll_interval)
+    , overflow_(overflow)
+{
+    if (!file_) {
+        fmt::print(stderr, "can't open binary log {}\n", path);
+        std::terminate();
+    }
+
+    std::fwrite(binlog::kMagic, 1, sizeof(binlog::kMagic), file_);
+    thread_ = std::thread(&BinaryLogging::run, this);
+}
+
+BinaryLogging::~BinaryLogging() {
+    {
+        std::lock_guard lk(m_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    std::fclose(file_);
+}
+
+void BinaryLogging::flush() {
+    std::unique_lock lk(m_);
+    auto ticket = ++flush_requested_;
+    cv_.notify_one();
+    written_cv_.wait(lk, [this, ticket] {
+        return written_ >= ticket;
+    });
+}
+
+uint32_t BinaryLogging::add_site(const LogSite& site, fmt::string_view fmt, std::vector<binlog::ArgType> types) {
+    std::lock_guard lk(m_);
+    // another thread may have registered it meanwhile
+    auto id = site.binary_id_.load(std::memory_order_relaxed);
+    if (id != 0) {
+        return id;
+    }
+
+    id = next_site_id_++;
+    pending_defs_.push_back(binlog::SiteTag);
+    put(pending_defs_, id);
+    put(pending_defs_, (uint8_t)site.level());
+    put(pending_defs_, (uint32_t)site.line_number());
+    put(pending_defs_, site.file());
+    put(pending_defs_, std::string_view(fmt.data(), fmt.size()));
+    put(pending_defs_, (uint8_t)types.size());
+    for (auto type : types) {
+        put(pending_defs_, (uint8_t)type);
+    }
+
+    site.binary_id_.store(id, std::memory_order_release);
+    return id;
+}
+
+std::shared_ptr<BinaryLogRing> BinaryLogging::add_ring() {
+    std::lock_guard lk(m_);
+    auto ring = std::make_shared<BinaryLogRing>(next_thread_index_++);
+    pending_defs_.push_back(binlog::ThreadTag);
+    put(pending_defs_, ring->thread_index());
+    put(pending_defs_, CurrentThread::get_id());
+    rings_.push_back(ring);
+    return ring;
+}
+
+char* BinaryLogging::reserve(BinaryLogRing& ring, size_t size) {
+    for (; ;) {
+        if (auto out = ring.reserve(size)) {
+            return out;
+        }
+
+        if (overflow_ == LogOverflow::Drop || size > kBinaryLogRingSize / 2) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        request_write();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void BinaryLogging::request_write() {
+    {
+        std::lock_guard lk(m_);
+        ++flush_requested_;
+    }
+    cv_.notify_one();
+}
+
+void BinaryLogging::run() {
+    std::vector<std::shared_ptr<BinaryLogRing>> rings;
+    std::vector<uint64_t> heads;
+    std::vector<char> defs;
+    std::vector<char> block;
+
+    std::unique_lock lk(m_);
+    for (; ;) {
+        cv_.wait_for(lk, poll_interval_, [this] {
+            return stop_ || flush_requested_ != written_;
+        });
+
+        auto ticket = flush_requested_;
+        bool stop = stop_;
+        rings = rings_;
+        lk.unlock();
+
+        // the heads are taken before the definitions, so every
+        // record written below has its site and thread defined
+        heads.clear();
+        for (auto& ring : rings) {
+            heads.push_back(ring->head());
+        }
+
+        lk.lock();
+        defs.swap(pending_defs_);
+        lk.unlock();
+
+        std::fwrite(defs.data(), 1, defs.size(), file_);
+        defs.clear();
+
+        for (size_t i = 0; i < rings.size(); ++i) {
+            auto& ring = *rings[i];
+
+            block.clear();
+            ring.drain(heads[i], block);
+            if (!block.empty()) {
+                std::vector<char> header;
+                header.push_back(binlog::BlockTag);
+                put(header, ring.thread_index());
+                put(header, (uint32_t)block.size());
+                std::fwrite(header.data(), 1, header.size(), file_);
+                std::fwrite(block.data(), 1, block.size(), file_);
+            }
+
+            if (auto dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+                std::vector<char> entry;
+                entry.push_back(binlog::DroppedTag);
+                put(entry, ring.thread_index());
+                put(entry, (uint64_t)dropped);
+                std::fwrite(entry.data(), 1, entry.size(), file_);
+            }
+        }
+        std::fflush(file_);
+        rings.clear();
+
+        lk.lock();
+        // a retired ring gets no more records once it is drained
+        for (auto it = rings_.begin(); it != rings_.end(); ) {
+            if ((*it)->retired.load(std::memory_order_acquire) && (*it)->drained()) {
+                it = rings_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        written_ = ticket;
+        written_cv_.notify_all();
+
+        if (stop) {
+            return;
+        }
+    }
+}
+
+}
\ No newline at end of file
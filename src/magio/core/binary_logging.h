@@ -0,0 +1,319 @@
+#ifndef MAGIO_CORE_BINARY_LOGGING_H_
+#define MAGIO_CORE_BINARY_LOGGING_H_
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <condition_variable>
+
+#include "fmt/core.h"
+
+#include "magio/core/log_site.h"
+#include "magio/core/noncopyable.h"
+#include "magio/core/async_logging.h"
+
+namespace magio {
+
+// per thread, a power of 2
+constexpr size_t kBinaryLogRingSize = 1 << 20;
+constexpr std::chrono::milliseconds kBinaryLogPollInterval{50};
+
+// File layout, all integers little endian as the host writes them:
+//   magic "MAGIOBL1", then entries starting with a tag byte
+//   'S' site: u32 id, u8 level, u32 line, u32 file size, file,
+//       u32 format size, format, u8 arg count, u8 arg types
+//   'T' thread: u32 index, u32 id size, id
+//   'B' records of a thread: u32 thread index, u32 byte size, records
+//   'D' dropped records: u32 thread index, u64 count
+// A record is u32 size (header and padding included), u32 site id,
+// u64 nanoseconds since the epoch, then the arguments: 8 bytes for
+// Int, Uint and Double, 4 for Float, 1 for Bool and Char, u32 size and
+// bytes for String
+namespace binlog {
+
+constexpr char kMagic[8] = {'M', 'A', 'G', 'I', 'O', 'B', 'L', '1'};
+
+enum Tag: char {
+    SiteTag = 'S',
+    ThreadTag = 'T',
+    BlockTag = 'B',
+    DroppedTag = 'D'
+};
+
+enum ArgType: uint8_t {
+    Int,
+    Uint,
+    Double,
+    Bool,
+    Char,
+    String,
+    // last, so the values above keep their meaning in older files
+    Float
+};
+
+constexpr size_t kRecordHeaderSize = 16;
+
+template<typename Stored, ArgType Type>
+struct ScalarArg {
+    static constexpr bool kBytewise = true;
+    static constexpr ArgType kType = Type;
+
+    template<typename T>
+    static size_t size(const T&) {
+        return sizeof(Stored);
+    }
+
+    template<typename T>
+    static char* encode(char* out, const T& arg) {
+        Stored stored = arg;
+        std::memcpy(out, &stored, sizeof(stored));
+        return out + sizeof(stored);
+    }
+};
+
+// How an argument is copied into a record. Only the types the decoder can
+// format itself have one, for the others BinaryLogging formats the message
+template<typename T, typename = void>
+struct Arg {
+    static constexpr bool kBytewise = false;
+};
+
+template<typename T>
+struct Arg<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>>
+    : std::conditional_t<std::is_signed_v<T>, ScalarArg<int64_t, Int>, ScalarArg<uint64_t, Uint>> { };
+
+template<>
+struct Arg<float>: ScalarArg<float, Float> { };
+
+template<typename T>
+struct Arg<T, std::enable_if_t<std::is_floating_point_v<T> && !std::is_same_v<T, float>>>
+    : ScalarArg<double, Double> { };
+
+template<>
+struct Arg<bool>: ScalarArg<bool, Bool> { };
+
+template<>
+struct Arg<char>: ScalarArg<char, Char> { };
+
+template<typename T>
+struct Arg<T, std::enable_if_t<std::is_convertible_v<const T&, std::string_view>>> {
+    static constexpr bool kBytewise = true;
+    static constexpr ArgType kType = String;
+
+    static size_t size(const T& arg) {
+        return sizeof(uint32_t) + std::string_view(arg).size();
+    }
+
+    static char* encode(char* out, const T& arg) {
+        std::string_view sv(arg);
+        auto n = (uint32_t)sv.size();
+        std::memcpy(out, &n, sizeof(n));
+        std::memcpy(out + sizeof(n), sv.data(), sv.size());
+        return out + sizeof(n) + sv.size();
+    }
+};
+
+}
+
+// Records of one thread on their way to the writer. Single producer,
+// single consumer. Records are 4 byte aligned and never wrap around,
+// a zero size word sends the reader back to the start
+class BinaryLogRing: Noncopyable {
+public:
+    explicit BinaryLogRing(uint32_t thread_index)
+        : thread_index_(thread_index)
+        , buf_(new char[kBinaryLogRingSize]) { }
+
+    // producer, nullptr if there is no room for size bytes
+    char* reserve(size_t size) {
+        auto head = head_.load(std::memory_order_relaxed);
+        size_t index = head & (kBinaryLogRingSize - 1);
+        size_t contiguous = kBinaryLogRingSize - index;
+        size_t need = contiguous < size ? contiguous + size : size;
+        if (kBinaryLogRingSize - (head - tail_.load(std::memory_order_acquire)) < need) {
+            return nullptr;
+        }
+
+        if (contiguous < size) {
+            std::memset(buf_.get() + index, 0, sizeof(uint32_t));
+            head += contiguous;
+            index = 0;
+        }
+        reserved_ = head + size;
+        return buf_.get() + index;
+    }
+
+    // producer, publishes the last reserve()
+    void commit() {
+        head_.store(reserved_, std::memory_order_release);
+    }
+
+    uint64_t head() const {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    bool drained() const {
+        return tail_.load(std::memory_order_relaxed) == head();
+    }
+
+    // consumer, appends the records before head to out
+    void drain(uint64_t head, std::vector<char>& out) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        while (tail < head) {
+            size_t index = tail & (kBinaryLogRingSize - 1);
+            uint32_t size;
+            std::memcpy(&size, buf_.get() + index, sizeof(size));
+            if (size == 0) {
+                tail += kBinaryLogRingSize - index;
+                continue;
+            }
+
+            out.insert(out.end(), buf_.get() + index, buf_.get() + index + size);
+            tail += size;
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    uint32_t thread_index() const {
+        return thread_index_;
+    }
+
+    std::atomic_uint64_t dropped = 0;
+    // set when the thread exits, the writer frees the ring once drained
+    std::atomic_bool retired = false;
+
+private:
+    uint32_t thread_index_;
+    std::unique_ptr<char[]> buf_;
+    // producer only, the head after the pending reserve()
+    uint64_t reserved_ = 0;
+
+    alignas(64) std::atomic_uint64_t head_ = 0;
+    alignas(64) std::atomic_uint64_t tail_ = 0;
+};
+
+namespace binlog {
+
+// a thread's ring, retired when the thread exits
+struct RingHolder {
+    ~RingHolder() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+
+    const void* owner = nullptr;
+    std::shared_ptr<BinaryLogRing> ring;
+};
+
+}
+
+// Deferred formatting backend. A call site registers its format string once,
+// after that a record is the site id, a timestamp and the raw arguments copied
+// into the thread's ring. A background thread moves the rings to the file,
+// tools/log_decoder turns the file back into text
+class BinaryLogging: Noncopyable {
+public:
+    BinaryLogging(const char* path, std::chrono::milliseconds poll_interval, LogOverflow overflow);
+
+    // writes what has been logged
+    ~BinaryLogging();
+
+    // A format spec may mean something only to the argument's own formatter,
+    // like {:%Y-%m-%d} on a time point, so a call with an argument the decoder
+    // can't format is formatted here and stored as a single string
+    template<typename...T>
+    void write(const LogSite& site, fmt::string_view fmt, const T&...args) {
+        if constexpr ((binlog::Arg<T>::kBytewise && ...)) {
+            write_record(site, fmt, args...);
+        } else {
+            auto msg = fmt::vformat(fmt, fmt::make_format_args(args...));
+            write_record(site, "{}", std::string_view(msg));
+        }
+    }
+
+    // returns once everything logged before the call is in the file
+    void flush();
+
+private:
+    template<typename...T>
+    void write_record(const LogSite& site, fmt::string_view fmt, const T&...args) {
+        auto id = site.binary_id_.load(std::memory_order_acquire);
+        if (id == 0) {
+            id = add_site(site, fmt, {binlog::Arg<T>::kType...});
+        }
+
+        size_t size = binlog::kRecordHeaderSize + (size_t(0) + ... + binlog::Arg<T>::size(args));
+        size = (size + 3) & ~size_t(3);
+
+        auto& ring = local_ring();
+        char* out = reserve(ring, size);
+        if (!out) {
+            return;
+        }
+
+        auto size32 = (uint32_t)size;
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        std::memcpy(out, &size32, sizeof(size32));
+        std::memcpy(out + 4, &id, sizeof(id));
+        std::memcpy(out + 8, &ns, sizeof(ns));
+
+        char* p = out + binlog::kRecordHeaderSize;
+        ((p = binlog::Arg<T>::encode(p, args)), ...);
+        ring.commit();
+    }
+
+    uint32_t add_site(const LogSite& site, fmt::string_view fmt, std::vector<binlog::ArgType> types);
+
+    BinaryLogRing& local_ring() {
+        auto& holder = local_ring_;
+        if (holder.owner != this) {
+            holder.owner = this;
+            holder.ring = add_ring();
+        }
+        return *holder.ring;
+    }
+
+    std::shared_ptr<BinaryLogRing> add_ring();
+
+    char* reserve(BinaryLogRing& ring, size_t size);
+
+    void request_write();
+
+    void run();
+
+    inline static thread_local binlog::RingHolder local_ring_;
+
+    std::FILE* file_;
+    std::chrono::milliseconds poll_interval_;
+    LogOverflow overflow_;
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::condition_variable written_cv_;
+
+    std::vector<std::shared_ptr<BinaryLogRing>> rings_;
+    // site and thread entries not in the file yet
+    std::vector<char> pending_defs_;
+    uint32_t next_site_id_ = 1;
+    uint32_t next_thread_index_ = 0;
+
+    size_t flush_requested_ = 0;
+    size_t written_ = 0;
+    bool stop_ = false;
+
+    std::thread thread_;
+};
+
+}
+
+#endif
\ No newline at end of file
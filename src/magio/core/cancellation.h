@@ -0,0 +1,162 @@
+#ifndef MAGIO_CORE_CANCELLATION_H_
+#define MAGIO_CORE_CANCELLATION_H_
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <exception>
+
+#include "magio/core/task.h"
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// Rejection of the promises a cancellation stops
+class Cancelled: public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "cancelled";
+    }
+};
+
+namespace detail {
+
+struct CancellationState: Noncopyable {
+    std::atomic_bool cancelled = false;
+
+    std::mutex m;
+    uint64_t next_id = 1;
+    std::vector<std::pair<uint64_t, Task>> callbacks;
+};
+
+}
+
+// Unregisters its callback when destroyed, unless it has run
+class CancellationRegistration {
+    friend class CancellationToken;
+
+    CancellationRegistration(std::weak_ptr<detail::CancellationState> state, uint64_t id)
+        : state_(std::move(state)), id_(id) { }
+
+public:
+    CancellationRegistration() = default;
+
+    CancellationRegistration(CancellationRegistration&& other) noexcept
+        : state_(std::move(other.state_)), id_(std::exchange(other.id_, 0)) { }
+
+    CancellationRegistration& operator=(CancellationRegistration&& other) noexcept {
+        CancellationRegistration(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~CancellationRegistration() {
+        reset();
+    }
+
+    void reset() {
+        auto state = state_.lock();
+        if (!state || id_ == 0) {
+            return;
+        }
+
+        std::lock_guard lk(state->m);
+        auto& callbacks = state->callbacks;
+        for (auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+            if (it->first == id_) {
+                callbacks.erase(it);
+                break;
+            }
+        }
+        id_ = 0;
+    }
+
+    void swap(CancellationRegistration& other) noexcept {
+        std::swap(state_, other.state_);
+        std::swap(id_, other.id_);
+    }
+
+private:
+    std::weak_ptr<detail::CancellationState> state_;
+    uint64_t id_ = 0;
+};
+
+// The observing side of a CancellationSource, cheap to copy. A default
+// constructed token is never cancelled
+class CancellationToken {
+    friend class CancellationSource;
+
+    explicit CancellationToken(std::shared_ptr<detail::CancellationState> state)
+        : state_(std::move(state)) { }
+
+public:
+    CancellationToken() = default;
+
+    bool cancelled() const {
+        return state_ && state_->cancelled.load(std::memory_order_acquire);
+    }
+
+    // fn runs once on the thread that cancels, or right here if the
+    // token already is cancelled. Keep the registration while fn may run
+    [[nodiscard]]
+    CancellationRegistration on_cancel(Task&& fn) const {
+        if (!state_) {
+            return {};
+        }
+
+        {
+            std::lock_guard lk(state_->m);
+            if (!state_->cancelled.load(std::memory_order_relaxed)) {
+                auto id = state_->next_id++;
+                state_->callbacks.emplace_back(id, std::move(fn));
+                return {state_, id};
+            }
+        }
+
+        fn();
+        return {};
+    }
+
+private:
+    std::shared_ptr<detail::CancellationState> state_;
+};
+
+class CancellationSource: Noncopyable {
+public:
+    CancellationSource()
+        : state_(std::make_shared<detail::CancellationState>()) { }
+
+    CancellationToken token() const {
+        return CancellationToken(state_);
+    }
+
+    bool cancelled() const {
+        return state_->cancelled.load(std::memory_order_acquire);
+    }
+
+    // runs the registered callbacks on this thread, only the first call does anything
+    void cancel() {
+        std::vector<std::pair<uint64_t, Task>> callbacks;
+        {
+            std::lock_guard lk(state_->m);
+            if (state_->cancelled.load(std::memory_order_relaxed)) {
+                return;
+            }
+            state_->cancelled.store(true, std::memory_order_release);
+            callbacks.swap(state_->callbacks);
+        }
+
+        for (auto& [id, fn] : callbacks) {
+            fn();
+        }
+    }
+
+private:
+    std::shared_ptr<detail::CancellationState> state_;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,238 @@
+#ifndef MAGIO_CORE_COROUTINE_H_
+#define MAGIO_CORE_COROUTINE_H_
+
+#include "magio/core/promise.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <array>
+#include <coroutine>
+
+namespace magio {
+
+// thrown by co_await on a promise rejected without a reason
+class PromiseRejected: public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "promise rejected";
+    }
+};
+
+namespace detail {
+
+constexpr size_t kFrameSizeStep = 64;
+constexpr size_t kFrameSizeClasses = 16;
+
+template<size_t Size>
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) FrameBlock {
+    unsigned char data[Size];
+};
+
+template<size_t I>
+using FrameClass = FrameBlock<(I + 1) * kFrameSizeStep>;
+
+template<size_t...I>
+constexpr auto make_frame_allocators(std::index_sequence<I...>) {
+    return std::array<void*(*)(), sizeof...(I)>{
+        [] () -> void* { return ObjectPool<FrameClass<I>>::create(); }...
+    };
+}
+
+template<size_t...I>
+constexpr auto make_frame_deallocators(std::index_sequence<I...>) {
+    return std::array<void(*)(void*), sizeof...(I)>{
+        [] (void* ptr) { ObjectPool<FrameClass<I>>::destroy(static_cast<FrameClass<I>*>(ptr)); }...
+    };
+}
+
+// Coroutine frames are rounded up to kFrameSizeStep and served from the
+// ObjectPool of their size class, bigger frames use the global allocator
+class FramePool {
+public:
+    static void* allocate(size_t size) {
+        auto index = (size - 1) / kFrameSizeStep;
+        if (index >= kFrameSizeClasses) {
+            return ::operator new(size);
+        }
+        return allocators_[index]();
+    }
+
+    static void deallocate(void* ptr, size_t size) {
+        auto index = (size - 1) / kFrameSizeStep;
+        if (index >= kFrameSizeClasses) {
+            ::operator delete(ptr);
+            return;
+        }
+        deallocators_[index](ptr);
+    }
+
+private:
+    static constexpr auto allocators_ = make_frame_allocators(std::make_index_sequence<kFrameSizeClasses>{});
+    static constexpr auto deallocators_ = make_frame_deallocators(std::make_index_sequence<kFrameSizeClasses>{});
+};
+
+// Owns a suspended frame until it is resumed, a frame whose awaited
+// promise is destroyed unsettled is destroyed with it
+class FrameHolder {
+public:
+    FrameHolder(std::coroutine_handle<> handle)
+        : handle_(handle) { }
+
+    FrameHolder(FrameHolder&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) { }
+
+    FrameHolder& operator=(FrameHolder&&) = delete;
+
+    ~FrameHolder() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    void resume() {
+        std::exchange(handle_, nullptr).resume();
+    }
+
+private:
+    std::coroutine_handle<> handle_;
+};
+
+template<typename T>
+class PromiseAwaiter {
+public:
+    PromiseAwaiter(PromisePtr<T> promise)
+        : promise_(std::move(promise))
+        , raw_(promise_.get()) { }
+
+    bool await_ready() const {
+        return raw_->state() != PromiseBase::Pending;
+    }
+
+    // The coroutine is resumed by a continuation running on the promise's
+    // executor, which holds the promise until the coroutine suspends again.
+    // The frame lets go of its reference meanwhile, otherwise a promise that
+    // never settles and the frame waiting on it would keep each other alive
+    void await_suspend(std::coroutine_handle<> handle) {
+        auto promise = std::move(promise_);
+        promise->attach([frame = FrameHolder(handle)](PromiseBase*) mutable {
+            frame.resume();
+        });
+    }
+
+    T await_resume() {
+        if (raw_->state() == PromiseBase::Rejected) {
+            if (raw_->eptr_) {
+                std::rethrow_exception(raw_->eptr_);
+            }
+            throw PromiseRejected();
+        }
+
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*raw_->value_);
+        }
+    }
+
+private:
+    PromisePtr<T> promise_;
+    Promise<T>* raw_;
+};
+
+// The coroutine state and the Promise<T> it returns. The body runs
+// eagerly on the calling thread up to its first co_await, like
+// spawn() with the Defer already in hand
+template<typename T>
+class CoroutinePromiseBase {
+public:
+    // the executor is the first argument of the coroutine that converts to Executor*
+    template<typename...Args>
+    CoroutinePromiseBase(Args&...args)
+        : promise_(Promise<T>::make(find_executor(args...))) { }
+
+    PromisePtr<T> get_return_object() {
+        return promise_;
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        promise_->reject_impl(std::current_exception());
+    }
+
+    static void* operator new(size_t size) {
+        return FramePool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        FramePool::deallocate(ptr, size);
+    }
+
+protected:
+    template<typename...Args>
+    static Executor* find_executor(Args&...args) {
+        static_assert(
+            (std::is_convertible_v<Args&, Executor*> || ...),
+            "A coroutine returning PromisePtr needs an Executor* argument");
+
+        Executor* executor = nullptr;
+        ([&] {
+            if constexpr (std::is_convertible_v<Args&, Executor*>) {
+                if (!executor) {
+                    executor = args;
+                }
+            }
+        }(), ...);
+        return executor;
+    }
+
+    template<typename...Args>
+    void resolve(Args&&...args) {
+        promise_->resolve_impl(std::forward<Args>(args)...);
+    }
+
+    PromisePtr<T> promise_;
+};
+
+template<typename T>
+class CoroutinePromise: public CoroutinePromiseBase<T> {
+public:
+    using CoroutinePromiseBase<T>::CoroutinePromiseBase;
+
+    template<typename U>
+    void return_value(U&& value) {
+        this->resolve(std::forward<U>(value));
+    }
+};
+
+template<>
+class CoroutinePromise<void>: public CoroutinePromiseBase<void> {
+public:
+    using CoroutinePromiseBase<void>::CoroutinePromiseBase;
+
+    void return_void() {
+        resolve();
+    }
+};
+
+}
+
+template<typename T>
+detail::PromiseAwaiter<T> operator co_await(PromisePtr<T> promise) {
+    return {std::move(promise)};
+}
+
+}
+
+template<typename T, typename...Args>
+struct std::coroutine_traits<magio::PromisePtr<T>, Args...> {
+    using promise_type = magio::detail::CoroutinePromise<T>;
+};
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "magio/core/dynamic_thread_pool.h"
+
+#include <iterator>
+#include <algorithm>
+
+#include "magio/core/logger.h"
+
+namespace magio {
+
+DynamicThreadPool::DynamicThreadPool(
+    size_t min_threads,
+    size_t max_threads,
+    std::chrono::milliseconds spawn_latency,
+    std::chrono::milliseconds keep_alive)
+    : min_threads_(min_threads)
+    , max_threads_(std::max({min_threads, max_threads, size_t(1)}))
+    , spawn_latency_(spawn_latency)
+    , keep_alive_(keep_alive)
+{ }
+
+DynamicThreadPool::~DynamicThreadPool() {
+    {
+        std::lock_guard lk(m_);
+        if (state_ != Running) {
+            return;
+        }
+    }
+
+    destroy();
+}
+
+void DynamicThreadPool::start() {
+    std::unique_lock lk(m_);
+    if (state_ != NotStarted) {
+        M_FATAL("{}", "You can't start thread pool twice");
+    }
+    state_ = Running;
+
+    for (size_t i = 0; i < min_threads_; ++i) {
+        spawn();
+    }
+    supervisor_thread_ = std::thread(&DynamicThreadPool::supervise, this);
+}
+
+void DynamicThreadPool::destroy() {
+    {
+        std::lock_guard lk(m_);
+        if (state_ == PendingDestroy) {
+            M_FATAL("{}", "You can't destroy thread pool twice");
+        }
+        state_ = PendingDestroy;
+    }
+    cv_.notify_all();
+    supervisor_cv_.notify_one();
+
+    if (supervisor_thread_.joinable()) {
+        supervisor_thread_.join();
+    }
+
+    // no worker is started any more, the map only shrinks
+    std::unordered_map<size_t, std::thread> threads;
+    {
+        std::lock_guard lk(m_);
+        threads.swap(threads_);
+        retired_.clear();
+    }
+    for (auto& [id, th] : threads) {
+        th.join();
+    }
+}
+
+size_t DynamicThreadPool::thread_count() {
+    std::lock_guard lk(m_);
+    return live_;
+}
+
+void DynamicThreadPool::post(Task&& task) {
+    auto now = TimerClock::now();
+    std::unique_lock lk(m_);
+    tasks_.push_back({std::move(task), now});
+    notify_posted(lk, now, 1);
+}
+
+void DynamicThreadPool::post_bulk(Task* tasks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    auto now = TimerClock::now();
+    std::unique_lock lk(m_);
+    for (size_t i = 0; i < n; ++i) {
+        tasks_.push_back({std::move(tasks[i]), now});
+    }
+    notify_posted(lk, now, n);
+}
+
+TimerHandle DynamicThreadPool::expires_until(const TimerClock::time_point& tp, TimerTask&& task) {
+    TimerHandle handle;
+    bool sooner;
+    {
+        std::lock_guard lk(m_);
+        handle = timer_queue_.push(tp, std::move(task));
+        sooner = tp < supervisor_deadline_;
+        if (sooner) {
+            supervisor_deadline_ = tp;
+        }
+    }
+
+    if (sooner) {
+        supervisor_cv_.notify_one();
+    }
+    return handle;
+}
+
+bool DynamicThreadPool::cancel(TimerHandle handle) {
+    TimerTask task;
+    {
+        std::lock_guard lk(m_);
+        task = timer_queue_.cancel(handle);
+    }
+
+    if (!task) {
+        return false;
+    }
+    task(false);
+    return true;
+}
+
+void DynamicThreadPool::notify_posted(std::unique_lock<std::mutex>& lk, TimerClock::time_point posted, size_t n) {
+    size_t idle = idle_;
+    bool wake_supervisor = false;
+    // more tasks than idle workers, one may have to be started,
+    // right away if there is no worker at all
+    if (tasks_.size() > idle_ && live_ < max_threads_) {
+        auto grow_at = live_ == 0 ? posted : posted + spawn_latency_;
+        if (grow_at < supervisor_deadline_) {
+            supervisor_deadline_ = grow_at;
+            wake_supervisor = true;
+        }
+    }
+    lk.unlock();
+
+    if (idle == 0) {
+        // nobody to wake
+    } else if (n >= idle) {
+        cv_.notify_all();
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            cv_.notify_one();
+        }
+    }
+
+    if (wake_supervisor) {
+        supervisor_cv_.notify_one();
+    }
+}
+
+void DynamicThreadPool::spawn() {
+    reap();
+
+    size_t id = next_id_++;
+    ++live_;
+    last_spawn_ = TimerClock::now();
+    threads_.emplace(id, std::thread(&DynamicThreadPool::run_in_background, this, id));
+}
+
+void DynamicThreadPool::reap() {
+    // a retired worker only has to return, joining it under m_ is short
+    for (size_t id : retired_) {
+        auto it = threads_.find(id);
+        it->second.join();
+        threads_.erase(it);
+    }
+    retired_.clear();
+}
+
+void DynamicThreadPool::run_in_background(size_t id) {
+    current_ = this;
+
+    std::unique_lock lk(m_);
+    for (; ;) {
+        if (state_ == PendingDestroy) {
+            M_TRACE("{}", "one thread function quit");
+            return;
+        }
+
+        if (tasks_.empty()) {
+            ++idle_;
+            bool woken = cv_.wait_for(lk, keep_alive_, [this] {
+                return !tasks_.empty() || state_ == PendingDestroy;
+            });
+            --idle_;
+
+            if (!woken && live_ > min_threads_) {
+                --live_;
+                retired_.push_back(id);
+                return;
+            }
+            continue;
+        }
+
+        auto task = std::move(tasks_.front().task);
+        tasks_.pop_front();
+        lk.unlock();
+
+        try {
+            task();
+        } catch(...) {
+            M_FATAL("{}", "Throw exception when thread function is running");
+        }
+
+        lk.lock();
+    }
+}
+
+void DynamicThreadPool::supervise() {
+    std::vector<TimerTask> expireds;
+    std::unique_lock lk(m_);
+
+    for (; ;) {
+        if (state_ == PendingDestroy) {
+            M_TRACE("{}", "supervisor function quit");
+            return;
+        }
+
+        auto now = TimerClock::now();
+        timer_queue_.get_expired(expireds);
+        if (!expireds.empty()) {
+            dispatch_expired(expireds, now);
+            lk.unlock();
+            cv_.notify_all();
+            lk.lock();
+            continue;
+        }
+
+        // one worker per spawn_latency at most, counted from
+        // the oldest task or the last start, whichever is later
+        auto deadline = TimerClock::time_point::max();
+        if (tasks_.size() > idle_ && live_ < max_threads_) {
+            auto grow_at = live_ == 0 ? now : std::max(tasks_.front().posted, last_spawn_) + spawn_latency_;
+            if (grow_at <= now) {
+                spawn();
+                continue;
+            }
+            deadline = grow_at;
+        }
+
+        if (auto next = timer_queue_.next_expiry()) {
+            deadline = std::min(deadline, *next);
+        }
+
+        supervisor_deadline_ = deadline;
+        if (deadline == TimerClock::time_point::max()) {
+            supervisor_cv_.wait(lk);
+        } else {
+            supervisor_cv_.wait_until(lk, deadline);
+        }
+        reap();
+    }
+}
+
+void DynamicThreadPool::dispatch_expired(std::vector<TimerTask>& expireds, TimerClock::time_point now) {
+    // one task per worker at most, so a slow callback
+    // holds back only the timers of its own batch
+    size_t batches = std::min(expireds.size(), std::max(live_, size_t(1)));
+    size_t batch_size = (expireds.size() + batches - 1) / batches;
+
+    for (size_t begin = 0; begin < expireds.size(); begin += batch_size) {
+        auto end = std::min(begin + batch_size, expireds.size());
+        std::vector<TimerTask> batch(
+            std::make_move_iterator(expireds.begin() + begin),
+            std::make_move_iterator(expireds.begin() + end));
+
+        Task task([batch = std::move(batch)]() mutable {
+            for (auto& task : batch) {
+                task(true);
+            }
+        });
+        tasks_.push_back({std::move(task), now});
+    }
+    expireds.clear();
+}
+
+}
\ No newline at end of file
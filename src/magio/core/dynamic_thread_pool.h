@@ -0,0 +1,115 @@
+#ifndef MAGIO_CORE_DYNAMIC_THREAD_POOL_H_
+#define MAGIO_CORE_DYNAMIC_THREAD_POOL_H_
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "magio/core/executor.h"
+#include "magio/core/timer_queue.h"
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// how long the oldest task may wait with every worker busy before another is started
+constexpr std::chrono::milliseconds kSpawnLatency{10};
+// how long a worker above the minimum may stay idle
+constexpr std::chrono::seconds kKeepAlive{60};
+
+// A pool that grows while tasks wait and shrinks while workers idle,
+// for tasks that block. Runs between min_threads and max_threads workers
+// on one shared queue. A supervisor thread fires the timers and starts a
+// worker whenever the oldest queued task has waited longer than
+// spawn_latency with no worker idle; a worker above min_threads exits
+// after keep_alive without a task
+class DynamicThreadPool final: Noncopyable, public Executor {
+public:
+    enum State {
+        NotStarted,
+        Running,
+        PendingDestroy
+    };
+
+    DynamicThreadPool(
+        size_t min_threads,
+        size_t max_threads,
+        std::chrono::milliseconds spawn_latency = kSpawnLatency,
+        std::chrono::milliseconds keep_alive = kKeepAlive);
+
+    ~DynamicThreadPool();
+
+    void start();
+
+    void destroy();
+
+    // workers right now, busy or not
+    size_t thread_count();
+
+    using Executor::post;
+
+    void post(Task&& task) override;
+
+    using Executor::post_bulk;
+
+    void post_bulk(Task* tasks, size_t n) override;
+
+    TimerHandle expires_until(const TimerClock::time_point& tp, TimerTask&& task) override;
+
+    bool cancel(TimerHandle handle) override;
+
+private:
+    struct Queued {
+        Task task;
+        TimerClock::time_point posted;
+    };
+
+    void run_in_background(size_t id);
+
+    void supervise();
+
+    // Releases lk after n posts, then wakes up to n idle workers and the
+    // supervisor if the posts may need another worker
+    void notify_posted(std::unique_lock<std::mutex>& lk, TimerClock::time_point posted, size_t n);
+
+    // called with m_ held
+
+    void spawn();
+
+    // joins the workers that have retired
+    void reap();
+
+    void dispatch_expired(std::vector<TimerTask>& expireds, TimerClock::time_point now);
+
+    size_t min_threads_;
+    size_t max_threads_;
+    std::chrono::milliseconds spawn_latency_;
+    std::chrono::milliseconds keep_alive_;
+
+    // guards everything below
+    std::mutex m_;
+    State state_ = NotStarted;
+
+    std::deque<Queued> tasks_;
+    std::condition_variable cv_;
+    size_t idle_ = 0;
+
+    // workers that haven't retired
+    size_t live_ = 0;
+    TimerClock::time_point last_spawn_;
+    std::unordered_map<size_t, std::thread> threads_;
+    std::vector<size_t> retired_;
+    size_t next_id_ = 0;
+
+    TimerQueue timer_queue_;
+    std::condition_variable supervisor_cv_;
+    // when the supervisor wakes up next, sooner work has to notify it
+    TimerClock::time_point supervisor_deadline_ = TimerClock::time_point::max();
+    std::thread supervisor_thread_;
+};
+
+}
+
+#endif
\ No newline at end of file
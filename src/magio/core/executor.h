@@ -1,25 +1,128 @@
 #ifndef MAGIO_CORE_EXECUTOR_H_
 #define MAGIO_CORE_EXECUTOR_H_
 
-#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+
+#include "magio/core/task.h"
+#include "magio/core/noncopyable.h"
 
 namespace magio {
 
+using TimerClock = std::chrono::steady_clock;
+
+// The lanes of an executor, workers take High before Normal before Low.
+// Executors without lanes run every task as Normal
+enum class Priority: uint8_t {
+    High,
+    Normal,
+    Low
+};
+
+constexpr size_t kPriorityLanes = 3;
+
+// Names a timer for cancel(). A handle stays safe to use after
+// its timer has fired or been cancelled, cancel() then does nothing
+class TimerHandle {
+    friend class TimerQueue;
+
+    TimerHandle(uint32_t index, uint32_t generation)
+        : index_(index), generation_(generation) { }
+
+public:
+    TimerHandle() = default;
+
+    explicit operator bool() const {
+        return generation_ != 0;
+    }
+
+private:
+    uint32_t index_ = 0;
+    uint32_t generation_ = 0;
+};
+
 // Interface
 class Executor {
 public:
     virtual ~Executor() = default;
 
-    virtual void post(std::function<void()>&&) = 0;
+    virtual void post(Task&&) = 0;
+
+    virtual void post(Task&& task, Priority priority) {
+        (void)priority;
+        post(std::move(task));
+    }
+
+    // Posts tasks[0, n) and leaves them empty. Implementations enqueue them
+    // with one synchronization step and wake at most n idle workers
+    virtual void post_bulk(Task* tasks, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            post(std::move(tasks[i]));
+        }
+    }
+
+    // any contiguous range of tasks
+    template<typename Range>
+    void post_bulk(Range& range) {
+        post_bulk(std::data(range), std::size(range));
+    }
+
+    // the executor whose worker is running the calling thread,
+    // nullptr on threads that belong to no executor
+    static Executor* current() {
+        return current_;
+    }
+
+    // the task is called with true once the time is up,
+    // or with false if the timer is cancelled first
+    template<typename Rep, typename Per>
+    TimerHandle expires_after(const std::chrono::duration<Rep, Per>& dur, TimerTask&& task) {
+        return expires_until(TimerClock::now() + dur, std::move(task));
+    }
+
+    virtual TimerHandle expires_until(const TimerClock::time_point& tp, TimerTask&&) = 0;
+
+    // False if the timer has already fired or been cancelled, otherwise its
+    // task is called with false. Executors that run timer tasks themselves
+    // call it before returning, adapters like Strand may queue it and call it
+    // later, so don't free what the task uses on the strength of cancel() alone
+    virtual bool cancel(TimerHandle) = 0;
+
+protected:
+    // set by implementations on each of their worker threads
+    inline static thread_local Executor* current_ = nullptr;
+};
+
+constexpr size_t kPostBatchSize = 16;
+
+// Gathers tasks for post_bulk(), posting them when it fills up,
+// when a task for another executor comes in and on destruction
+class PostBatch: Noncopyable {
+public:
+    ~PostBatch() {
+        flush();
+    }
 
-    // template<typename Rep, typename Per>
-    // void expires_after(const std::chrono::duration<Rep, Per>& dur, std::function<void(bool)>&&);
+    void push(Executor* executor, Task&& task) {
+        if (executor != executor_ || size_ == kPostBatchSize) {
+            flush();
+            executor_ = executor;
+        }
+        tasks_[size_++] = std::move(task);
+    }
 
-    // void expires_until(const std::chrono::steady_clock::time_point& tp, std::function<void(bool)>&&);
+    void flush() {
+        if (size_ > 0) {
+            executor_->post_bulk(tasks_, size_);
+            size_ = 0;
+        }
+    }
 
-    // void cancel();
-    
 private:
+    Executor* executor_ = nullptr;
+    size_t size_ = 0;
+    Task tasks_[kPostBatchSize];
 };
 
 }
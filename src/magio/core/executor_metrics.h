@@ -0,0 +1,146 @@
+#ifndef MAGIO_CORE_EXECUTOR_METRICS_H_
+#define MAGIO_CORE_EXECUTOR_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+// 0 compiles the executor instrumentation out, metrics() then reads zeros.
+// With 1 it is still off until enable_metrics(true)
+#ifndef MAGIO_EXECUTOR_METRICS
+#define MAGIO_EXECUTOR_METRICS 1
+#endif
+
+namespace magio {
+
+// bucket i holds durations in [2^i, 2^(i+1)) ns, the last one everything longer
+constexpr size_t kHistogramBuckets = 40;
+
+struct HistogramSnapshot {
+    uint64_t buckets[kHistogramBuckets] = {};
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+
+    void merge(const HistogramSnapshot& other) {
+        for (size_t i = 0; i < kHistogramBuckets; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        sum_ns += other.sum_ns;
+    }
+
+    double mean_ns() const {
+        return count == 0 ? 0 : (double)sum_ns / count;
+    }
+
+    // upper bound of the bucket holding the p-th quantile, p in [0, 1]
+    uint64_t percentile_ns(double p) const {
+        auto rank = (uint64_t)(p * count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kHistogramBuckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return uint64_t(2) << i;
+            }
+        }
+        return count == 0 ? 0 : uint64_t(2) << (kHistogramBuckets - 1);
+    }
+};
+
+namespace detail {
+
+inline uint64_t metrics_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Written by one thread, read by any. Plain loads and stores
+// instead of read-modify-writes, the writer owns the cache line
+class Counter {
+public:
+    void add(uint64_t n) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void max(uint64_t n) {
+        if (n > value_.load(std::memory_order_relaxed)) {
+            value_.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic_uint64_t value_ = 0;
+};
+
+// log bucketed durations, single writer like Counter
+class Histogram {
+public:
+    void record(uint64_t ns) {
+        size_t bucket = 0;
+        for (uint64_t v = ns >> 1; v != 0 && bucket + 1 < kHistogramBuckets; v >>= 1) {
+            ++bucket;
+        }
+        buckets_[bucket].add(1);
+        count_.add(1);
+        sum_.add(ns);
+    }
+
+    void read(HistogramSnapshot& out) const {
+        HistogramSnapshot snapshot;
+        for (size_t i = 0; i < kHistogramBuckets; ++i) {
+            snapshot.buckets[i] = buckets_[i].get();
+        }
+        snapshot.count = count_.get();
+        snapshot.sum_ns = sum_.get();
+        out.merge(snapshot);
+    }
+
+private:
+    Counter buckets_[kHistogramBuckets];
+    Counter count_;
+    Counter sum_;
+};
+
+// what one worker records
+struct WorkerMetrics {
+    Counter tasks;
+    // post to start
+    Histogram wait;
+    // start to finish
+    Histogram run;
+    // between tasks, parked or looking for one
+    Counter idle_ns;
+    Counter park_ns;
+    Counter parks;
+    // sampled by the worker when it takes a task
+    Counter local_depth_max;
+    Counter inject_depth_max;
+};
+
+}
+
+// A point in time view of an executor, summed over its workers
+struct ExecutorMetrics {
+    uint64_t tasks = 0;
+    std::vector<uint64_t> tasks_per_worker;
+    HistogramSnapshot wait;
+    HistogramSnapshot run;
+    uint64_t idle_ns = 0;
+    uint64_t park_ns = 0;
+    uint64_t parks = 0;
+    // high water marks of a worker's own queue and of its group's shared
+    // queue, as seen by the workers when they take tasks
+    uint64_t local_depth_max = 0;
+    uint64_t inject_depth_max = 0;
+    // how late expired timers are dispatched, per poller wakeup
+    HistogramSnapshot timer_lateness;
+};
+
+}
+
+#endif
\ No newline at end of file
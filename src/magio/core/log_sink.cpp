@@ -0,0 +1,233 @@
+#include "magio/core/log_sink.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fmt/chrono.h"
+
+namespace magio {
+
+void StdoutSink::write(std::string_view records) {
+    std::fwrite(records.data(), 1, records.size(), stdout);
+}
+
+void StdoutSink::flush() {
+    std::fflush(stdout);
+}
+
+FileSink::FileSink(std::string path, FileRotation rotation, FileSinkMode mode)
+    : path_(std::move(path))
+    , rotation_(rotation)
+    , mode_(mode)
+{
+    // a file rotated by size needs no more than max_size mapped
+    segment_size_ = kFileSinkSegmentSize;
+    if (rotation_.max_size > 0 && rotation_.max_size < segment_size_) {
+        size_t page = (size_t)::sysconf(_SC_PAGESIZE);
+        segment_size_ = (rotation_.max_size + page - 1) / page * page;
+    }
+
+    if (mode_ == FileSinkMode::Write) {
+        stage_ = std::make_unique<Stage>();
+    }
+
+    if (!open()) {
+        throw std::system_error(errno, std::generic_category(), path_);
+    }
+}
+
+FileSink::~FileSink() {
+    close();
+}
+
+void FileSink::write(std::string_view records) {
+    if (rotation_.interval.count() > 0 && std::time(nullptr) >= next_rotation_) {
+        rotate();
+    }
+
+    // the file could not be opened again after the last rotation
+    if (fd_ < 0 && !open()) {
+        return;
+    }
+
+    while (!records.empty()) {
+        auto part = cut(records);
+        if (part.empty()) {
+            rotate();
+            if (fd_ < 0) {
+                return;
+            }
+            continue;
+        }
+
+        append(part);
+        records.remove_prefix(part.size());
+    }
+}
+
+void FileSink::flush() {
+    if (mode_ == FileSinkMode::Write) {
+        write_fd(stage_->str_view());
+        stage_->clear();
+    }
+}
+
+bool FileSink::open() {
+    int flags = mode_ == FileSinkMode::Mmap ? O_RDWR | O_CREAT : O_WRONLY | O_CREAT | O_APPEND;
+    fd_ = ::open(path_.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    struct stat st{};
+    ::fstat(fd_, &st);
+    file_size_ = (size_t)st.st_size;
+    segment_offset_ = file_size_ - file_size_ % segment_size_;
+
+    opened_ = std::time(nullptr);
+    if (rotation_.interval.count() > 0) {
+        std::time_t interval = rotation_.interval.count();
+        next_rotation_ = (opened_ / interval + 1) * interval;
+    }
+    return true;
+}
+
+void FileSink::close() {
+    if (fd_ < 0) {
+        return;
+    }
+
+    if (mode_ == FileSinkMode::Write) {
+        flush();
+    } else if (segment_) {
+        ::munmap(segment_, segment_size_);
+        segment_ = nullptr;
+        // drop the preallocated tail
+        if (::ftruncate(fd_, (off_t)file_size_) != 0) {
+            fmt::print(stderr, "can't truncate log file {}: {}\n", path_, std::strerror(errno));
+        }
+    }
+
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void FileSink::rotate() {
+    if (fd_ >= 0 && file_size_ == 0) {
+        std::time_t interval = rotation_.interval.count();
+        if (interval > 0) {
+            next_rotation_ = (std::time(nullptr) / interval + 1) * interval;
+        }
+        return;
+    }
+
+    close();
+    auto rotated = fmt::format("{}.{:%Y%m%d-%H%M%S}.{}", path_, fmt::localtime(opened_), sequence_++);
+    std::rename(path_.c_str(), rotated.c_str());
+    open();
+}
+
+std::string_view FileSink::cut(std::string_view records) const {
+    if (rotation_.max_size == 0) {
+        return records;
+    }
+
+    size_t room = file_size_ < rotation_.max_size ? rotation_.max_size - file_size_ : 0;
+    if (records.size() <= room) {
+        return records;
+    }
+
+    if (room > 0) {
+        auto end = records.rfind('\n', room - 1);
+        if (end != std::string_view::npos) {
+            return records.substr(0, end + 1);
+        }
+    }
+
+    // a record larger than max_size gets a file of its own
+    if (file_size_ == 0) {
+        auto end = records.find('\n');
+        return records.substr(0, end == std::string_view::npos ? records.size() : end + 1);
+    }
+    return {};
+}
+
+void FileSink::append(std::string_view data) {
+    while (mode_ == FileSinkMode::Mmap && !data.empty()) {
+        if (!segment_ || file_size_ == segment_offset_ + segment_size_) {
+            // may fall back to Write mode
+            map_segment();
+            continue;
+        }
+
+        size_t n = std::min(data.size(), segment_offset_ + segment_size_ - file_size_);
+        std::memcpy(segment_ + (file_size_ - segment_offset_), data.data(), n);
+        file_size_ += n;
+        data.remove_prefix(n);
+    }
+
+    if (data.empty()) {
+        return;
+    }
+
+    file_size_ += data.size();
+    if (data.size() > stage_->rest()) {
+        flush();
+    }
+
+    if (data.size() >= kFileSinkStageSize) {
+        write_fd(data);
+    } else {
+        stage_->append(data);
+    }
+}
+
+void FileSink::write_fd(std::string_view data) {
+    while (!data.empty()) {
+        auto n = ::write(fd_, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data.remove_prefix((size_t)n);
+    }
+}
+
+void FileSink::map_segment() {
+    if (segment_) {
+        ::munmap(segment_, segment_size_);
+        segment_ = nullptr;
+        segment_offset_ += segment_size_;
+    }
+
+    // allocated up front, a full disk shows up here and not as SIGBUS on a store
+    void* p = MAP_FAILED;
+    if (::posix_fallocate(fd_, (off_t)segment_offset_, (off_t)segment_size_) == 0) {
+        p = ::mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, (off_t)segment_offset_);
+    }
+
+    if (p == MAP_FAILED) {
+        // carry on with write(2) from the end of the records, which is not
+        // the end of the file if the preallocated tail can't be dropped
+        if (::ftruncate(fd_, (off_t)file_size_) != 0) {
+            fmt::print(stderr, "can't truncate log file {}: {}\n", path_, std::strerror(errno));
+        }
+        ::lseek(fd_, (off_t)file_size_, SEEK_SET);
+        mode_ = FileSinkMode::Write;
+        stage_ = std::make_unique<Stage>();
+        return;
+    }
+    segment_ = static_cast<char*>(p);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef MAGIO_CORE_LOG_SINK_H_
+#define MAGIO_CORE_LOG_SINK_H_
+
+#include <ctime>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "magio/core/noncopyable.h"
+#include "magio/core/static_buffer.h"
+
+namespace magio {
+
+// Where formatted records end up. The logger serializes the calls,
+// records arrive whole, one or many at a time
+class LogSink: Noncopyable {
+public:
+    virtual ~LogSink() = default;
+
+    virtual void write(std::string_view records) = 0;
+
+    // hands what has been written so far to the OS
+    virtual void flush() = 0;
+};
+
+class StdoutSink: public LogSink {
+public:
+    void write(std::string_view records) override;
+
+    void flush() override;
+};
+
+// when a FileSink starts a new file, either limit may be 0
+struct FileRotation {
+    // bytes, a file is cut at the last record that fits
+    size_t max_size = 0;
+    // aligned to the UTC clock, hours start on the hour
+    std::chrono::seconds interval{0};
+};
+
+enum class FileSinkMode {
+    // staged in a buffer, written with write(2) when it fills or on flush
+    Write,
+    // copied into a mapped, preallocated segment of the file, nothing
+    // to flush and the records survive a crash of the process
+    Mmap
+};
+
+constexpr size_t kFileSinkStageSize = 64 * 1024;
+constexpr size_t kFileSinkSegmentSize = 16 * 1024 * 1024;
+
+// Writes to path. A rotated file is renamed to path.YYYYmmdd-HHMMSS.N,
+// the time it was opened and a sequence number, and path starts empty.
+// Throws std::system_error if the file can't be opened
+class FileSink: public LogSink {
+    using Stage = StaticBuffer<kFileSinkStageSize>;
+
+public:
+    explicit FileSink(std::string path, FileRotation rotation = {}, FileSinkMode mode = FileSinkMode::Write);
+
+    ~FileSink() override;
+
+    void write(std::string_view records) override;
+
+    void flush() override;
+
+private:
+    bool open();
+
+    void close();
+
+    void rotate();
+
+    // the part of records that goes to the current file
+    std::string_view cut(std::string_view records) const;
+
+    void append(std::string_view data);
+
+    void write_fd(std::string_view data);
+
+    void map_segment();
+
+    std::string path_;
+    FileRotation rotation_;
+    FileSinkMode mode_;
+
+    int fd_ = -1;
+    std::time_t opened_ = 0;
+    std::time_t next_rotation_ = 0;
+    size_t file_size_ = 0;
+    size_t sequence_ = 0;
+
+    // Write mode
+    std::unique_ptr<Stage> stage_;
+
+    // Mmap mode, the mapped segment starts at segment_offset_
+    char* segment_ = nullptr;
+    size_t segment_size_;
+    size_t segment_offset_ = 0;
+};
+
+namespace detail {
+
+// Every sink gets every record, stdout when no sink was added
+class LogSinks: public LogSink {
+public:
+    void add(std::shared_ptr<LogSink> sink) {
+        sinks_.push_back(std::move(sink));
+    }
+
+    void write(std::string_view records) override {
+        if (sinks_.empty()) {
+            stdout_.write(records);
+            return;
+        }
+
+        for (auto& sink : sinks_) {
+            sink->write(records);
+        }
+    }
+
+    void flush() override {
+        if (sinks_.empty()) {
+            stdout_.flush();
+            return;
+        }
+
+        for (auto& sink : sinks_) {
+            sink->flush();
+        }
+    }
+
+private:
+    StdoutSink stdout_;
+    std::vector<std::shared_ptr<LogSink>> sinks_;
+};
+
+}
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef MAGIO_CORE_LOG_SITE_H_
+#define MAGIO_CORE_LOG_SITE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+namespace magio {
+
+enum class LogLevel {
+    Off,
+    Trace,
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Fatal
+};
+
+// The constant part of a record, built at compile time for each M_* call
+// site. Call sites keep it in a static, constant initialized, so the only
+// runtime state is the id the binary backend hands out on first use
+class LogSite {
+    friend class BinaryLogging;
+
+public:
+    constexpr LogSite(LogLevel level, const char* file, int line)
+        : level_(level), file_(file), line_number_(line)
+    {
+        char digits[sizeof(line_)]{};
+        size_t n = 0;
+        do {
+            digits[n++] = (char)('0' + line % 10);
+            line /= 10;
+        } while (line > 0);
+
+        while (n > 0) {
+            line_[line_size_++] = digits[--n];
+        }
+    }
+
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+
+    constexpr LogLevel level() const {
+        return level_;
+    }
+
+    constexpr std::string_view file() const {
+        return file_;
+    }
+
+    constexpr int line_number() const {
+        return line_number_;
+    }
+
+    constexpr std::string_view line() const {
+        return {line_, line_size_};
+    }
+
+private:
+    LogLevel level_;
+    std::string_view file_;
+    int line_number_;
+    char line_[12]{};
+    size_t line_size_ = 0;
+    // 0 until the site is registered with a BinaryLogging
+    mutable std::atomic_uint32_t binary_id_ = 0;
+};
+
+}
+
+#endif
\ No newline at end of file
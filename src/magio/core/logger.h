@@ -1,23 +1,43 @@
 #ifndef MAGIO_CORE_LOGGER_H_
 #define MAGIO_CORE_LOGGER_H_
 
+#include <ctime>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <iterator>
+#include <string_view>
+
+#include "magio/core/log_site.h"
+#include "magio/core/log_sink.h"
+#include "magio/core/async_logging.h"
+#include "magio/core/binary_logging.h"
 #include "magio/core/static_buffer.h"
 #include "magio/core/current_thread.h"
 
 #include "fmt/chrono.h"
 
+// M_* calls below this level compile to nothing, M_FATAL always stays.
+// 1 keeps everything, 3 drops M_TRACE and M_DEBUG
+#ifndef MAGIO_LOG_MIN_LEVEL
+#define MAGIO_LOG_MIN_LEVEL 1
+#endif
+
 namespace magio {
 
-enum class LogLevel {
-    Off,
-    Trace,
-    Debug,
-    Info,
-    Warn,
-    Error,
-    Fatal
+namespace detail {
+
+// the date and time of one second, formatted again only when the second changes
+struct TimestampCache {
+    std::time_t second = -1;
+    char date[16];
+    size_t date_size = 0;
+    char time[16];
+    size_t time_size = 0;
 };
 
+}
+
 class Logger {
     Logger() = default;
 
@@ -29,7 +49,9 @@ public:
         Time        = 0b00000100,
         File        = 0b00001000,
         Line        = 0b00010000,
-        ThreadId    = 0b00100000
+        ThreadId    = 0b00100000,
+        // adds .uuuuuu to Time
+        Microsecond = 0b01000000
     };
 
     Logger(const Logger&) = delete;
@@ -43,74 +65,135 @@ public:
         ins().pattern_= pattern;
     }
 
+    // Every record goes to every sink, to stdout until the first one is
+    // added. Call it before other threads start logging
+    static void add_sink(std::shared_ptr<LogSink> sink) {
+        ins().sinks_.add(std::move(sink));
+    }
+
+    // Records are still formatted on the calling thread but written by
+    // a background thread, a buffer at a time. Call it before other
+    // threads start logging
+    static void set_async(
+        std::chrono::milliseconds flush_interval = kLogFlushInterval,
+        LogOverflow overflow = LogOverflow::Block)
+    {
+        ins().async_ = std::make_unique<AsyncLogging>(ins().sinks_, flush_interval, overflow);
+    }
+
+    // Records are not formatted at all, the raw arguments go to a binary
+    // file at path, read it with tools/log_decoder. Call it before other
+    // threads start logging, it replaces set_async
+    static void set_binary(const char* path, LogOverflow overflow = LogOverflow::Block) {
+        ins().binary_ = std::make_unique<BinaryLogging>(path, kBinaryLogPollInterval, overflow);
+    }
+
+    // returns once the records written so far are out, M_FATAL calls it
+    static void flush() {
+        if (ins().binary_) {
+            ins().binary_->flush();
+        } else if (ins().async_) {
+            ins().async_->flush();
+        } else {
+            std::lock_guard lk(ins().sinks_m_);
+            ins().sinks_.flush();
+        }
+    }
+
     template <typename... T>
-    static void write(const char* file, int line, LogLevel level, fmt::format_string<T...> fmt, T&&... args) {
-        if ((int)ins().level_ > (int)level) {
+    static void write(const LogSite& site, fmt::format_string<T...> fmt, T&&... args) {
+        if ((int)ins().level_ > (int)site.level()) {
             return;
         }
 
-        build_fmt_string(file, line, level, fmt);
-        fmt::vprint(local_fmt.str_view(), fmt::make_format_args(args...));
+        if (ins().binary_) {
+            ins().binary_->write(site, fmt, args...);
+            return;
+        }
+
+        local_record.clear();
+        append_prefix(site);
+        fmt::vformat_to(std::back_inserter(local_record), fmt, fmt::make_format_args(args...));
+        append("\n");
+
+        std::string_view record{local_record.data(), local_record.size()};
+        if (ins().async_) {
+            ins().async_->append(record);
+        } else {
+            std::lock_guard lk(ins().sinks_m_);
+            ins().sinks_.write(record);
+        }
     }
 
 private:
-    static void build_fmt_string(const char* file, int line, LogLevel level, fmt::string_view fmt) {
-        local_fmt.clear();
-        
-        if (ins().pattern_ & Level) {
-            switch (level) {
-            case LogLevel::Trace:
-                local_fmt.append("trace ");
-                break;
-            case LogLevel::Debug:
-                local_fmt.append("debug ");
-                break;
-            case LogLevel::Info:
-                local_fmt.append("info ");
-                break;
-            case LogLevel::Warn:
-                local_fmt.append("warn ");
-                break;
-            case LogLevel::Error:
-                local_fmt.append("error ");
-                break;
-            case LogLevel::Fatal:
-                local_fmt.append("fatal ");
-                break;
-            default:
-                break;
-            }
+    static void append(std::string_view text) {
+        local_record.append(text.data(), text.data() + text.size());
+    }
+
+    static void append_prefix(const LogSite& site) {
+        static constexpr std::string_view level_names[] = {
+            "", "trace ", "debug ", "info ", "warn ", "error ", "fatal "
+        };
+
+        int pattern = ins().pattern_;
+
+        if (pattern & Level) {
+            append(level_names[(int)site.level()]);
         }
 
-        auto date_n_time = fmt::localtime(std::chrono::system_clock::now());
-        if (ins().pattern_ & Date) {
-            local_fmt.append_format("{:%Y-%m-%d} ", fmt::make_format_args(date_n_time));
+        if (pattern & (Date | Time)) {
+            append_timestamp(pattern);
         }
 
-        if (ins().pattern_ & Time) {
-            local_fmt.append_format("{:%H:%M:%S} ", fmt::make_format_args(date_n_time));
+        if (pattern & File) {
+            append("f:");
+            append(site.file());
+            append(" ");
         }
 
-        if (ins().pattern_ & File) {
-            local_fmt.append("f:");
-            local_fmt.append(file);
-            local_fmt.append(" ");
+        if (pattern & Line) {
+            append("l:");
+            append(site.line());
+            append(" ");
         }
 
-        if (ins().pattern_ & Line) {
-            local_fmt.append("l:");
-            local_fmt.append(std::to_string(line));
-            local_fmt.append(" ");
+        if (pattern & ThreadId) {
+            append("id:");
+            append(CurrentThread::get_id());
+            append(" ");
+        }
+    }
+
+    static void append_timestamp(int pattern) {
+        using namespace std::chrono;
+
+        auto now = system_clock::now();
+        auto second = system_clock::to_time_t(now);
+        auto& cache = local_timestamp;
+        if (second != cache.second) {
+            auto tm = fmt::localtime(second);
+            cache.second = second;
+            cache.date_size = fmt::format_to_n(cache.date, sizeof(cache.date), "{:%Y-%m-%d}", tm).size;
+            cache.time_size = fmt::format_to_n(cache.time, sizeof(cache.time), "{:%H:%M:%S}", tm).size;
         }
 
-        if (ins().pattern_ & ThreadId) {
-            local_fmt.append("id:");
-            local_fmt.append(CurrentThread::get_id());
-            local_fmt.append(" ");
+        if (pattern & Date) {
+            append({cache.date, cache.date_size});
+            append(" ");
         }
 
-        local_fmt.append({fmt.data(), fmt.size()});
-        local_fmt.append("\n");
+        if (pattern & Time) {
+            append({cache.time, cache.time_size});
+            if (pattern & Microsecond) {
+                auto us = duration_cast<microseconds>(now.time_since_epoch()).count() % 1000000;
+                char text[7] = {'.'};
+                for (size_t i = 6; i > 0; --i, us /= 10) {
+                    text[i] = (char)('0' + us % 10);
+                }
+                append({text, sizeof(text)});
+            }
+            append(" ");
+        }
     }
 
     static Logger& ins() {
@@ -118,24 +201,58 @@ private:
         return logger;
     }
 
-    inline static thread_local detail::FormatBuffer local_fmt;
-    
+    // the record being formatted, on the heap only when it is longer than kSmallBufferSize
+    inline static thread_local fmt::basic_memory_buffer<char, kSmallBufferSize> local_record{};
+    inline static thread_local detail::TimestampCache local_timestamp;
+
     LogLevel level_ = LogLevel::Debug;
     int pattern_ = Level | Date | Time | File | Line | ThreadId;
+    // outlives async_, which writes to it
+    detail::LogSinks sinks_;
+    // serializes the sinks when there is no background thread
+    std::mutex sinks_m_;
+    std::unique_ptr<AsyncLogging> async_;
+    std::unique_ptr<BinaryLogging> binary_;
 };
 
-#define M_TRACE(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Trace, FMT, __VA_ARGS__); } while(0)
-#define M_DEBUG(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Debug, FMT, __VA_ARGS__); } while(0)
-#define M_INFO(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Info, FMT, __VA_ARGS__); } while(0)
-#define M_WARN(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Warn, FMT, __VA_ARGS__); } while(0)
-#define M_ERROR(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Error, FMT, __VA_ARGS__); } while(0)
+#define MAGIO_LOG(LEVEL, FMT, ...) \
+    do { \
+        static ::magio::LogSite magio_log_site(LEVEL, __FILE__, __LINE__); \
+        ::magio::Logger::write(magio_log_site, FMT, __VA_ARGS__); \
+    } while(0)
+
+#if MAGIO_LOG_MIN_LEVEL <= 1
+#define M_TRACE(FMT, ...) MAGIO_LOG(::magio::LogLevel::Trace, FMT, __VA_ARGS__)
+#else
+#define M_TRACE(FMT, ...) do { } while(0)
+#endif
+
+#if MAGIO_LOG_MIN_LEVEL <= 2
+#define M_DEBUG(FMT, ...) MAGIO_LOG(::magio::LogLevel::Debug, FMT, __VA_ARGS__)
+#else
+#define M_DEBUG(FMT, ...) do { } while(0)
+#endif
+
+#if MAGIO_LOG_MIN_LEVEL <= 3
+#define M_INFO(FMT, ...) MAGIO_LOG(::magio::LogLevel::Info, FMT, __VA_ARGS__)
+#else
+#define M_INFO(FMT, ...) do { } while(0)
+#endif
+
+#if MAGIO_LOG_MIN_LEVEL <= 4
+#define M_WARN(FMT, ...) MAGIO_LOG(::magio::LogLevel::Warn, FMT, __VA_ARGS__)
+#else
+#define M_WARN(FMT, ...) do { } while(0)
+#endif
+
+#if MAGIO_LOG_MIN_LEVEL <= 5
+#define M_ERROR(FMT, ...) MAGIO_LOG(::magio::LogLevel::Error, FMT, __VA_ARGS__)
+#else
+#define M_ERROR(FMT, ...) do { } while(0)
+#endif
+
 #define M_FATAL(FMT, ...) \
-    do { ::magio::Logger::write(__FILE__, __LINE__, ::magio::LogLevel::Fatal, FMT, __VA_ARGS__); std::terminate(); } while(0)
+    do { MAGIO_LOG(::magio::LogLevel::Fatal, FMT, __VA_ARGS__); ::magio::Logger::flush(); std::terminate(); } while(0)
 
 }
 
@@ -0,0 +1,228 @@
+#include "magio/core/loop_executor.h"
+
+#include <utility>
+
+#include "magio/core/logger.h"
+#include "magio/core/object_pool.h"
+
+namespace magio {
+
+LoopExecutor::Scope::Scope(LoopExecutor* loop)
+    : prev_loop_(std::exchange(local_loop_, loop))
+    , prev_executor_(std::exchange(current_, loop)) { }
+
+LoopExecutor::Scope::~Scope() {
+    local_loop_ = prev_loop_;
+    current_ = prev_executor_;
+}
+
+LoopExecutor::~LoopExecutor() {
+    for (auto node = inbox_.exchange(nullptr, std::memory_order_acquire); node; ) {
+        ObjectPool<InboxNode>::destroy(std::exchange(node, node->next));
+    }
+}
+
+size_t LoopExecutor::run() {
+    return run_tasks(SIZE_MAX, true, TimerClock::time_point::max());
+}
+
+size_t LoopExecutor::run_one() {
+    return run_tasks(1, true, TimerClock::time_point::max());
+}
+
+size_t LoopExecutor::poll() {
+    return run_tasks(SIZE_MAX, false, TimerClock::time_point::min());
+}
+
+size_t LoopExecutor::run_until(const TimerClock::time_point& tp) {
+    return run_tasks(SIZE_MAX, true, tp);
+}
+
+void LoopExecutor::stop() {
+    stopped_.store(true, std::memory_order_release);
+    { std::lock_guard lk(m_); }
+    cv_.notify_all();
+}
+
+void LoopExecutor::post(Task&& task) {
+    if (local_loop_ == this) {
+        tasks_.push_back(std::move(task));
+        return;
+    }
+
+    auto node = ObjectPool<InboxNode>::create(InboxNode{nullptr, std::move(task)});
+    push_inbox(node, node);
+}
+
+void LoopExecutor::post_bulk(Task* tasks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    if (local_loop_ == this) {
+        for (size_t i = 0; i < n; ++i) {
+            tasks_.push_back(std::move(tasks[i]));
+        }
+        return;
+    }
+
+    // newest first, like the inbox
+    InboxNode* first = nullptr;
+    InboxNode* last = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        first = ObjectPool<InboxNode>::create(InboxNode{first, std::move(tasks[i])});
+        if (!last) {
+            last = first;
+        }
+    }
+    push_inbox(first, last);
+}
+
+void LoopExecutor::push_inbox(InboxNode* first, InboxNode* last) {
+    // seq_cst pairs with wait_until(): either the loop sees
+    // the node or we see it sleeping
+    auto head = inbox_.load(std::memory_order_relaxed);
+    do {
+        last->next = head;
+    } while (!inbox_.compare_exchange_weak(head, first, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    if (sleeping_.load(std::memory_order_seq_cst)) {
+        { std::lock_guard lk(m_); }
+        cv_.notify_one();
+    }
+}
+
+TimerHandle LoopExecutor::expires_until(const TimerClock::time_point& tp, TimerTask&& task) {
+    TimerHandle handle;
+    bool sooner;
+    {
+        std::lock_guard lk(m_);
+        handle = timer_queue_.push(tp, std::move(task));
+        if (tp.time_since_epoch().count() < next_expiry_.load(std::memory_order_relaxed)) {
+            next_expiry_.store(tp.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+        sooner = sleeping_.load(std::memory_order_relaxed) && tp < sleep_deadline_;
+        if (sooner) {
+            sleep_deadline_ = tp;
+        }
+    }
+
+    if (sooner) {
+        cv_.notify_one();
+    }
+    return handle;
+}
+
+bool LoopExecutor::cancel(TimerHandle handle) {
+    TimerTask task;
+    {
+        std::lock_guard lk(m_);
+        task = timer_queue_.cancel(handle);
+    }
+
+    if (!task) {
+        return false;
+    }
+    task(false);
+    return true;
+}
+
+size_t LoopExecutor::run_tasks(size_t limit, bool wait, TimerClock::time_point deadline) {
+    Scope scope(this);
+
+    size_t n = 0;
+    while (n < limit && !stopped()) {
+        if ((tasks_.empty() && expireds_.empty()) || ++ticks_ % kLoopPollInterval == 0) {
+            gather();
+        }
+
+        if (!expireds_.empty()) {
+            auto task = std::move(expireds_.front());
+            expireds_.pop_front();
+            ++n;
+            try {
+                task(true);
+            } catch(...) {
+                M_FATAL("{}", "Throw exception when timer task is running");
+            }
+            continue;
+        }
+
+        if (!tasks_.empty()) {
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            ++n;
+            try {
+                task();
+            } catch(...) {
+                M_FATAL("{}", "Throw exception when loop task is running");
+            }
+            continue;
+        }
+
+        if (!wait || TimerClock::now() >= deadline) {
+            break;
+        }
+        wait_until(deadline);
+    }
+
+    return n;
+}
+
+void LoopExecutor::gather() {
+    if (auto node = inbox_.exchange(nullptr, std::memory_order_acquire)) {
+        // the inbox is newest first, reverse it for FIFO
+        InboxNode* head = nullptr;
+        while (node) {
+            auto next = std::exchange(node->next, head);
+            head = std::exchange(node, next);
+        }
+
+        while (head) {
+            tasks_.push_back(std::move(head->task));
+            ObjectPool<InboxNode>::destroy(std::exchange(head, head->next));
+        }
+    }
+
+    if (next_expiry_.load(std::memory_order_relaxed) > TimerClock::now().time_since_epoch().count()) {
+        return;
+    }
+
+    {
+        std::lock_guard lk(m_);
+        timer_queue_.get_expired(expired_buf_);
+        auto next = timer_queue_.next_expiry().value_or(TimerClock::time_point::max());
+        next_expiry_.store(next.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    for (auto& task : expired_buf_) {
+        expireds_.push_back(std::move(task));
+    }
+    expired_buf_.clear();
+}
+
+void LoopExecutor::wait_until(TimerClock::time_point deadline) {
+    std::unique_lock lk(m_);
+    sleeping_.store(true, std::memory_order_seq_cst);
+
+    // a post that missed sleeping_ is in the inbox by now
+    if (inbox_.load(std::memory_order_seq_cst) || stopped()) {
+        sleeping_.store(false, std::memory_order_relaxed);
+        return;
+    }
+
+    if (auto next = timer_queue_.next_expiry()) {
+        deadline = std::min(deadline, *next);
+    }
+
+    sleep_deadline_ = deadline;
+    if (deadline == TimerClock::time_point::max()) {
+        cv_.wait(lk);
+    } else {
+        cv_.wait_until(lk, deadline);
+    }
+    sleep_deadline_ = TimerClock::time_point::max();
+    sleeping_.store(false, std::memory_order_relaxed);
+}
+
+}
\ No newline at end of file
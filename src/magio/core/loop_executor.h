@@ -0,0 +1,132 @@
+#ifndef MAGIO_CORE_LOOP_EXECUTOR_H_
+#define MAGIO_CORE_LOOP_EXECUTOR_H_
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <condition_variable>
+
+#include "magio/core/executor.h"
+#include "magio/core/timer_queue.h"
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// how many tasks of the loop's own queue run between two looks at the inbox
+// and the timers, so posts from a busy loop can't starve the other threads
+constexpr size_t kLoopPollInterval = 32;
+
+// An executor without threads of its own, driven by the thread that calls
+// run(), run_one(), poll() or run_for(), one thread at a time. Posts made
+// from inside the loop go to a plain deque, posts from other threads to a
+// lock free inbox the loop drains, so a promise chain that stays on the loop
+// costs about a function call per continuation. Timers sit behind a mutex,
+// since any thread may set or cancel one
+class LoopExecutor final: Noncopyable, public Executor {
+public:
+    LoopExecutor() = default;
+
+    // drops the tasks that haven't run
+    ~LoopExecutor();
+
+    // Runs tasks until stop(), waiting while there are none.
+    // The run functions return how many tasks they have run
+    size_t run();
+
+    // runs one task, waiting until there is one unless stop() comes first
+    size_t run_one();
+
+    // runs the tasks and timers that are ready, without waiting
+    size_t poll();
+
+    // as run(), for at most dur
+    template<typename Rep, typename Per>
+    size_t run_for(const std::chrono::duration<Rep, Per>& dur) {
+        return run_until(TimerClock::now() + dur);
+    }
+
+    size_t run_until(const TimerClock::time_point& tp);
+
+    // makes the run functions return after the task they are running,
+    // and return at once until restart(). Callable from any thread
+    void stop();
+
+    bool stopped() const {
+        return stopped_.load(std::memory_order_acquire);
+    }
+
+    void restart() {
+        stopped_.store(false, std::memory_order_release);
+    }
+
+    using Executor::post;
+
+    void post(Task&& task) override;
+
+    using Executor::post_bulk;
+
+    void post_bulk(Task* tasks, size_t n) override;
+
+    TimerHandle expires_until(const TimerClock::time_point& tp, TimerTask&& task) override;
+
+    bool cancel(TimerHandle handle) override;
+
+private:
+    struct InboxNode {
+        InboxNode* next;
+        Task task;
+    };
+
+    // makes the calling thread the loop's while it lives
+    class Scope: Noncopyable {
+    public:
+        explicit Scope(LoopExecutor* loop);
+
+        ~Scope();
+
+    private:
+        LoopExecutor* prev_loop_;
+        Executor* prev_executor_;
+    };
+
+    // runs up to limit tasks, waiting for more until deadline if wait is set
+    size_t run_tasks(size_t limit, bool wait, TimerClock::time_point deadline);
+
+    // links [first, last] into the inbox and wakes the loop if it sleeps
+    void push_inbox(InboxNode* first, InboxNode* last);
+
+    // called from the loop
+
+    // moves the inbox and the expired timers to the loop's queues
+    void gather();
+
+    void wait_until(TimerClock::time_point deadline);
+
+    inline static thread_local LoopExecutor* local_loop_ = nullptr;
+
+    // the loop's own, unsynchronized
+    std::deque<Task> tasks_;
+    std::deque<TimerTask> expireds_;
+    std::vector<TimerTask> expired_buf_;
+    size_t ticks_ = 0;
+
+    // a stack, newest first
+    std::atomic<InboxNode*> inbox_ = nullptr;
+    std::atomic_bool stopped_ = false;
+    std::atomic_bool sleeping_ = false;
+    // the earliest timer, in TimerClock ticks, so the loop
+    // only takes m_ when one may have expired
+    std::atomic<TimerClock::rep> next_expiry_ = TimerClock::time_point::max().time_since_epoch().count();
+
+    // guards the timers and sleeping
+    std::mutex m_;
+    std::condition_variable cv_;
+    TimerQueue timer_queue_;
+    // when the loop wakes up next, a timer due earlier has to notify it
+    TimerClock::time_point sleep_deadline_ = TimerClock::time_point::max();
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef MAGIO_CORE_MPMC_QUEUE_H_
+#define MAGIO_CORE_MPMC_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// Bounded lock free multi producer multi consumer queue (Dmitry Vyukov's
+// algorithm). Each cell carries a sequence number telling producers and
+// consumers whose turn it is, so a push or a pop is a single CAS on the
+// position plus a release store on the cell
+template<typename T>
+class MpmcQueue: Noncopyable {
+    struct Cell {
+        std::atomic_size_t sequence;
+        T data;
+    };
+
+public:
+    // capacity must be a power of two
+    MpmcQueue(size_t capacity)
+        : mask_(capacity - 1)
+        , cells_(new Cell[capacity])
+    {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // data is only moved from when the push succeeds
+    bool try_push(T&& data) {
+        Cell* cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (; ;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(data);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& data) {
+        Cell* cell;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (; ;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        data = std::move(cell->data);
+        cell->data = T{};
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // may report a push that is still being written as non empty
+    bool empty() const {
+        return enqueue_pos_.load() == dequeue_pos_.load();
+    }
+
+    // a snapshot that may be off by the pushes and pops in flight
+    size_t size() const {
+        size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+private:
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(64) std::atomic_size_t enqueue_pos_ = 0;
+    alignas(64) std::atomic_size_t dequeue_pos_ = 0;
+};
+
+}
+
+#endif
\ No newline at end of file
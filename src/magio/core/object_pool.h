@@ -0,0 +1,133 @@
+#ifndef MAGIO_CORE_OBJECT_POOL_H_
+#define MAGIO_CORE_OBJECT_POOL_H_
+
+#include <new>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+
+namespace magio {
+
+constexpr size_t kObjectPoolBatchSize = 64;
+
+// Per thread free list of blocks sized for T. Blocks go back to the
+// cache of the thread that frees them. Caches trade whole batches
+// through a shared depot, so a thread that only allocates refills
+// from the threads that only free, and takes the depot lock once
+// every kObjectPoolBatchSize objects
+template<typename T>
+class ObjectPool {
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "Over aligned types are not supported");
+
+    // overlays a free block, the batch fields are only set on the first block of a batch
+    struct Block {
+        Block* next;
+        Block* next_batch;
+        size_t count;
+    };
+
+    static constexpr size_t kBlockSize = std::max(sizeof(T), sizeof(Block));
+
+    struct Depot {
+        ~Depot() {
+            while (batches) {
+                auto batch = std::exchange(batches, batches->next_batch);
+                while (batch) {
+                    ::operator delete(std::exchange(batch, batch->next));
+                }
+            }
+        }
+
+        void push(Block* batch, size_t count) {
+            batch->count = count;
+            std::lock_guard lk(m);
+            batch->next_batch = std::exchange(batches, batch);
+        }
+
+        Block* pop() {
+            std::lock_guard lk(m);
+            if (batches) {
+                return std::exchange(batches, batches->next_batch);
+            }
+            return nullptr;
+        }
+
+        std::mutex m;
+        Block* batches = nullptr;
+    };
+
+    struct Cache {
+        ~Cache() {
+            if (head) {
+                depot().push(head, size);
+                head = nullptr;
+            }
+        }
+
+        Block* head = nullptr;
+        size_t size = 0;
+    };
+
+public:
+    template<typename...Args>
+    static T* create(Args&&...args) {
+        void* mem = allocate();
+        try {
+            return ::new (mem) T(std::forward<Args>(args)...);
+        } catch(...) {
+            deallocate(mem);
+            throw;
+        }
+    }
+
+    static void destroy(T* ptr) {
+        ptr->~T();
+        deallocate(ptr);
+    }
+
+private:
+    static void* allocate() {
+        auto& c = cache();
+        if (!c.head) {
+            c.head = depot().pop();
+            c.size = c.head ? c.head->count : 0;
+        }
+
+        if (c.head) {
+            --c.size;
+            return std::exchange(c.head, c.head->next);
+        }
+        return ::operator new(kBlockSize);
+    }
+
+    static void deallocate(void* mem) {
+        auto& c = cache();
+        auto block = ::new (mem) Block;
+        block->next = std::exchange(c.head, block);
+        ++c.size;
+
+        if (c.size == 2 * kObjectPoolBatchSize) {
+            // hand the older half to the depot
+            auto last = c.head;
+            for (size_t i = 1; i < kObjectPoolBatchSize; ++i) {
+                last = last->next;
+            }
+            depot().push(std::exchange(last->next, nullptr), kObjectPoolBatchSize);
+            c.size = kObjectPoolBatchSize;
+        }
+    }
+
+    static Cache& cache() {
+        static thread_local Cache c;
+        return c;
+    }
+
+    static Depot& depot() {
+        static Depot d;
+        return d;
+    }
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -1,42 +1,190 @@
 #ifndef MAGIO_CORE_PROMISE_H_
 #define MAGIO_CORE_PROMISE_H_
 
-#include <mutex>
+#include <new>
 #include <memory>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <optional>
+#include <exception>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 
 #include "magio/core/traits.h"
 #include "magio/core/executor.h"
 #include "magio/core/noncopyable.h"
+#include "magio/core/cancellation.h"
+#include "magio/core/object_pool.h"
+#include "magio/core/promise_trace.h"
 #include "magio/dev/memory_check.h"
 
 namespace magio {
 
+template<typename T = void>
 class Promise;
 
-using PromisePtr = std::shared_ptr<Promise>;
+// How the continuations of a promise are run once it settles
+enum class Dispatch {
+    // always posted to the executor
+    Post,
+    // run on the settling thread when that thread is already a worker
+    // of the promise's executor, posted otherwise. Nested inline runs
+    // are bounded by kMaxInlineDepth, deeper ones are posted
+    Inline
+};
+
+// how many inline continuations may nest on one thread's stack
+constexpr size_t kMaxInlineDepth = 32;
+
+// Intrusive reference to a Promise, the size of one pointer
+template<typename T = void>
+class PromisePtr {
+    template<typename>
+    friend class Promise;
+
+    explicit PromisePtr(Promise<T>* ptr)
+        : ptr_(ptr) { }
+
+public:
+    PromisePtr() = default;
+
+    PromisePtr(std::nullptr_t) { }
+
+    PromisePtr(const PromisePtr& other) noexcept;
+
+    PromisePtr(PromisePtr&& other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)) { }
+
+    PromisePtr& operator=(const PromisePtr& other) {
+        PromisePtr(other).swap(*this);
+        return *this;
+    }
+
+    PromisePtr& operator=(PromisePtr&& other) noexcept {
+        PromisePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~PromisePtr();
+
+    Promise<T>* get() const {
+        return ptr_;
+    }
+
+    Promise<T>* operator->() const {
+        return ptr_;
+    }
+
+    Promise<T>& operator*() const {
+        return *ptr_;
+    }
+
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+
+    void swap(PromisePtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+    }
+
+    friend bool operator==(const PromisePtr& left, const PromisePtr& right) {
+        return left.ptr_ == right.ptr_;
+    }
+
+    friend bool operator!=(const PromisePtr& left, const PromisePtr& right) {
+        return left.ptr_ != right.ptr_;
+    }
+
+private:
+    Promise<T>* ptr_ = nullptr;
+};
 
+template<typename T = void>
 class Defer {
+    template<typename>
     friend class Promise;
 
-    Defer (const std::shared_ptr<Promise>& promise)
-        : promise_(promise) { }
+    Defer(PromisePtr<T> promise)
+        : promise_(std::move(promise)) { }
 
 public:
-    void resolve() const;
+    // Defer<void>::resolve() takes nothing,
+    // Defer<T>::resolve(args...) constructs the value in place
+    template<typename...Args>
+    void resolve(Args&&...args) const;
 
-    void reject() const;
+    // an empty exception_ptr rejects without a reason
+    void reject(std::exception_ptr eptr = nullptr) const;
 
 private:
-    std::shared_ptr<Promise> promise_;
+    PromisePtr<T> promise_;
 };
 
-class Promise: public std::enable_shared_from_this<Promise> {
-    friend class Defer;
-    
-    Promise(Executor* executor)
-        : executor_(executor) { }
+namespace detail {
+
+struct Void { };
+
+// coroutine support, see magio/core/coroutine.h
+template<typename>
+class PromiseAwaiter;
+template<typename>
+class CoroutinePromiseBase;
+
+template<typename T>
+using ValueOf = std::conditional_t<std::is_void_v<T>, Void, T>;
+
+class PromiseBase;
+
+// A handler that a cancellation may take away before it runs. The first
+// of take() and cancel() wins, cancel() destroys the handler with its
+// captures at once and rejects defer with Cancelled
+template<typename Fn, typename U>
+struct CancellableCall: Noncopyable {
+    CancellableCall(Fn fn, Defer<U> defer)
+        : fn(std::move(fn)), defer(std::move(defer)) { }
+
+    std::optional<Fn> take() {
+        if (claimed.exchange(true, std::memory_order_acq_rel)) {
+            return std::nullopt;
+        }
+        return std::move(fn);
+    }
+
+    void cancel() {
+        if (claimed.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        fn.reset();
+        defer.reject(std::make_exception_ptr(Cancelled()));
+    }
+
+    std::atomic_bool claimed = false;
+    std::optional<Fn> fn;
+    Defer<U> defer;
+    CancellationRegistration registration;
+};
+
+// A then() or fail() waiting on a pending promise, linked
+// into the promise's continuation stack. fn is called with
+// the settled promise
+struct Continuation {
+    Continuation* next;
+    BasicTask<void(PromiseBase*)> fn;
+};
+
+struct ContinuationDeleter {
+    void operator()(Continuation* node) const {
+        ObjectPool<Continuation>::destroy(node);
+    }
+};
+
+// owns a detached continuation until it has run, or until
+// the executor drops it without running it
+using ContinuationPtr = std::unique_ptr<Continuation, ContinuationDeleter>;
 
+class PromiseBase: Noncopyable {
 public:
     enum State {
         Pending,
@@ -44,218 +192,807 @@ public:
         Rejected
     };
 
-    static PromisePtr spawn(Executor* executor, std::function<void(Defer)>&& fn) {
-        MAGIO_NEW_PROMISE;
-        std::shared_ptr<Promise> ptr(new Promise(executor), 
-            [](Promise* p) {
-                MAGIO_DESTROY_PROMISE;
-                delete p;
-            });
+    State state() const {
+        auto word = state_.load(std::memory_order_acquire);
+        return word == Resolved || word == Rejected ? (State)word : Pending;
+    }
 
-        executor->post([ptr, fn = std::move(fn)] {
-            fn(Defer(ptr));
-        });
-        return ptr;
+    Executor* executor() const {
+        return executor_;
     }
 
-    static PromisePtr resolve(Executor* executor) {
-        return spawn(executor, [](Defer defer) {
-            defer.resolve();
-        });
+    Dispatch dispatch_policy() const {
+        return dispatch_.load(std::memory_order_relaxed);
     }
 
-    static PromisePtr reject(Executor* executor) {
-        return spawn(executor, [](Defer defer) {
-            defer.reject();
-        });
+    // the lane continuations are posted to
+    Priority priority() const {
+        return priority_.load(std::memory_order_relaxed);
     }
 
-    template<
-        typename Range,
-        constraint<
-            IsRange<Range>::value &&
-            std::is_same_v<PromisePtr, typename RangeTraits<Range>::ValueType>
-        > = 0
-    >
-    static PromisePtr all(Executor* executor, const Range& range) {
-        return sync_spawn(executor, [&range](Defer defer) {
-            auto counter = std::make_shared<std::atomic_size_t>(0);
-
-            for (auto& ptr : range) {
-                counter->fetch_add(1);
-                ptr->then([counter, defer] {
-                    counter->fetch_sub(1);
-                    if (*counter == 0) {
-                        defer.resolve();
-                    }
-                }, [defer] {
-                    defer.reject();
-                });
+protected:
+    PromiseBase(Executor* executor, Dispatch dispatch, Priority priority)
+        : executor_(executor)
+        , dispatch_(dispatch)
+        , priority_(priority) { }
+
+    ~PromiseBase() {
+        auto word = state_.load(std::memory_order_acquire);
+        if (word != Resolved && word != Rejected) {
+            for (auto node = (Continuation*)(word & ~kSettling); node; ) {
+                ObjectPool<Continuation>::destroy(std::exchange(node, node->next));
             }
-        });
+        }
     }
 
-    template<
-        typename Range,
-        constraint<
-            IsRange<Range>::value &&
-            std::is_same_v<PromisePtr, typename RangeTraits<Range>::ValueType>
-        > = 0
-    >
-    static PromisePtr race(Executor* executor, const Range& range) {
-        return sync_spawn(executor, [&range](Defer defer) {
-            for (auto& ptr : range) {
-                ptr->then([defer] {
-                    defer.resolve();
-                }, [defer] {
-                    defer.reject();
-                });
+    // false if the promise has already settled and the node was not linked
+    bool push_continuation(Continuation* node) {
+        auto word = state_.load(std::memory_order_acquire);
+        do {
+            if (word == Resolved || word == Rejected) {
+                return false;
             }
-        });
+            node->next = (Continuation*)(word & ~kSettling);
+        } while (!state_.compare_exchange_weak(
+            word, (uintptr_t)node | (word & kSettling), std::memory_order_acq_rel, std::memory_order_acquire));
+
+        return true;
     }
 
-    template<typename OnResolved, typename OnRejected>
-    PromisePtr then(OnResolved on_resolved, OnRejected on_rejected) {
-        auto new_promise = sync_spawn(
-            executor_, 
-            [
-                ptr = shared_from_this(),
-                on_resolved = std::move(on_resolved),
-                on_rejected = std::move(on_rejected)
-            ] (Defer defer) mutable {
-                std::lock_guard lk(ptr->mutex_);
-                ptr->resolve_fns_.emplace_back(func_impl(defer, std::move(on_resolved), true));
-                ptr->reject_fns_.emplace_back(func_impl(defer, std::move(on_rejected), true));
+    // only the first resolve or reject wins the right to store its result
+    bool claim() {
+        auto word = state_.load(std::memory_order_relaxed);
+        do {
+            if (word & (kSettling | Resolved | Rejected)) {
+                return false;
             }
-        );
+        } while (!state_.compare_exchange_weak(
+            word, word | kSettling, std::memory_order_acquire, std::memory_order_relaxed));
 
-        return new_promise;
+        return true;
     }
 
-    template<typename OnResolved>
-    PromisePtr then(OnResolved on_resolved) {
-        auto new_promise = sync_spawn(
-            executor_, 
-            [
-                ptr = shared_from_this(),
-                on_resolved = std::move(on_resolved)
-            ](Defer defer) mutable {
-                ptr->resolve_fns_.emplace_back(func_impl(defer, std::move(on_resolved), true));
-                ptr->reject_fns_.emplace_back(func_impl(defer, [] {}, false));
+    // Publishes the result stored by the claimer and detaches
+    // the continuations, in the order they were added
+    Continuation* publish(State state) {
+        auto word = state_.exchange(state, std::memory_order_acq_rel);
+
+        Continuation* head = nullptr;
+        for (auto node = (Continuation*)(word & ~kSettling); node; ) {
+            auto next = std::exchange(node->next, head);
+            head = std::exchange(node, next);
+        }
+        return head;
+    }
+
+    bool can_run_inline() const {
+        return dispatch_policy() == Dispatch::Inline
+            && Executor::current() == executor_
+            && inline_depth_ < kMaxInlineDepth;
+    }
+
+    // counts the inline continuations on this thread's stack
+    struct InlineScope: Noncopyable {
+        InlineScope() {
+            ++inline_depth_;
+        }
+
+        ~InlineScope() {
+            --inline_depth_;
+        }
+    };
+
+    inline static thread_local size_t inline_depth_ = 0;
+
+    // set on a pending word while the winner of claim() stores the result
+    static constexpr uintptr_t kSettling = 4;
+
+    std::atomic_uint32_t refs_ = 1;
+    Executor* executor_;
+    std::atomic<Dispatch> dispatch_;
+    std::atomic<Priority> priority_;
+    // Pending with the continuation stack head (nullptr when empty),
+    // or Resolved / Rejected once settled
+    std::atomic<uintptr_t> state_ = 0;
+    std::exception_ptr eptr_;
+    // 0 unless made while PromiseTrace was on
+    uint64_t trace_id_ = 0;
+};
+
+template<typename R>
+struct Unwrap {
+    using Type = R;
+};
+
+template<typename U>
+struct Unwrap<PromisePtr<U>> {
+    using Type = U;
+};
+
+template<typename R>
+struct IsPromisePtr: std::false_type { };
+
+template<typename U>
+struct IsPromisePtr<PromisePtr<U>>: std::true_type { };
+
+// on_resolved may take the value as T&& or ignore it
+template<typename Fn, typename T, typename = void>
+struct ResolvedResult {
+    using Type = std::invoke_result_t<Fn&>;
+};
+
+template<typename Fn, typename T>
+struct ResolvedResult<Fn, T, std::enable_if_t<!std::is_void_v<T> && std::is_invocable_v<Fn&, T&&>>> {
+    using Type = std::invoke_result_t<Fn&, T&&>;
+};
+
+// on_rejected may take the std::exception_ptr or ignore it
+template<typename Fn, typename = void>
+struct RejectedResult {
+    using Type = std::invoke_result_t<Fn&>;
+};
+
+template<typename Fn>
+struct RejectedResult<Fn, std::enable_if_t<std::is_invocable_v<Fn&, std::exception_ptr>>> {
+    using Type = std::invoke_result_t<Fn&, std::exception_ptr>;
+};
+
+// U of a range of PromisePtr<U>
+template<typename Range>
+using RangePromiseValue = typename Unwrap<std::decay_t<typename RangeTraits<const Range&>::ValueType>>::Type;
+
+// State shared by the continuations a combinator attaches to its inputs,
+// allocated in one block with a result slot per input. Freed by whoever
+// sees the last input arrive
+template<typename Slot, typename Out>
+class Aggregate: Noncopyable {
+    static_assert(alignof(Slot) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "over-aligned slot");
+
+    Aggregate(size_t size, Defer<Out> defer)
+        : left_(size), size_(size), defer_(std::move(defer)) { }
+
+public:
+    static Aggregate* create(size_t size, Defer<Out> defer) {
+        auto mem = ::operator new(slots_offset() + size * sizeof(Slot));
+        auto agg = ::new (mem) Aggregate(size, std::move(defer));
+        std::uninitialized_value_construct_n(agg->begin(), size);
+        return agg;
+    }
+
+    void destroy() {
+        std::destroy_n(begin(), size_);
+        this->~Aggregate();
+        ::operator delete(this);
+    }
+
+    // true for the first caller only, which settles the output early
+    bool decide() {
+        return !decided_.exchange(true, std::memory_order_relaxed);
+    }
+
+    bool decided() const {
+        return decided_.load(std::memory_order_relaxed);
+    }
+
+    // true for the last input to arrive
+    bool arrive() {
+        return left_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    const Defer<Out>& defer() const {
+        return defer_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    Slot& operator[](size_t index) {
+        return begin()[index];
+    }
+
+    Slot* begin() {
+        return std::launder(reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(this) + slots_offset()));
+    }
+
+    Slot* end() {
+        return begin() + size_;
+    }
+
+private:
+    static constexpr size_t slots_offset() {
+        return (sizeof(Aggregate) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+    }
+
+    std::atomic_size_t left_;
+    std::atomic_bool decided_ = false;
+    size_t size_;
+    Defer<Out> defer_;
+};
+
+}
+
+// One input of Promise::all_settled(), value is set if it resolved
+template<typename T>
+struct Settled {
+    bool resolved() const {
+        return value.has_value();
+    }
+
+    std::optional<detail::ValueOf<T>> value;
+    std::exception_ptr eptr;
+};
+
+// Rejection of Promise::any() when every input rejects
+class AllRejected: public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "all promises rejected";
+    }
+
+    // the rejection of each input, by index
+    std::vector<std::exception_ptr> reasons;
+};
+
+// A promise settles once, either resolved with a T or rejected with
+// an std::exception_ptr. The value is handed to continuations as T&&,
+// a handler taking T by value moves it out of the promise, so a promise
+// whose value is consumed should have a single consumer. Handlers that
+// throw reject the promise returned by then() / fail()
+template<typename T>
+class Promise: public detail::PromiseBase {
+    template<typename>
+    friend class Promise;
+    template<typename>
+    friend class Defer;
+    template<typename>
+    friend class PromisePtr;
+    friend class ObjectPool<Promise>;
+    friend class detail::PromiseAwaiter<T>;
+    friend class detail::CoroutinePromiseBase<T>;
+
+    Promise(Executor* executor, Dispatch dispatch, Priority priority)
+        : PromiseBase(executor, dispatch, priority) { }
+
+public:
+    using ValueType = T;
+
+    template<typename Fn>
+    static PromisePtr<T> spawn(Executor* executor, Fn&& fn) {
+        return spawn(executor, Priority::Normal, std::forward<Fn>(fn));
+    }
+
+    // fn runs in the priority lane, which the returned promise
+    // and the ones chained to it pass on to their continuations
+    template<typename Fn>
+    static PromisePtr<T> spawn(Executor* executor, Priority priority, Fn&& fn) {
+        auto ptr = make(executor, Dispatch::Post, priority);
+        executor->post([ptr, fn = std::forward<Fn>(fn), task = PromiseTrace::on_post(ptr->trace_id_)]() mutable {
+            TraceRun run(task, ptr->trace_id_);
+            try {
+                fn(Defer<T>(ptr));
+            } catch(...) {
+                ptr->reject_impl(std::current_exception());
             }
-        );
+        }, priority);
+        return ptr;
+    }
+
+    // fn is skipped if token is cancelled before it starts, the
+    // returned promise then rejects with Cancelled right away
+    template<typename Fn>
+    static PromisePtr<T> spawn(Executor* executor, const CancellationToken& token, Fn&& fn) {
+        auto ptr = make(executor);
+        auto call = make_cancellable(token, std::forward<Fn>(fn), Defer<T>(ptr));
+        executor->post([call, promise = ptr->trace_id_, task = PromiseTrace::on_post(ptr->trace_id_)] {
+            TraceRun run(task, promise);
+            if (auto fn = call->take()) {
+                try {
+                    (*fn)(call->defer);
+                } catch(...) {
+                    call->defer.reject(std::current_exception());
+                }
+            }
+        });
+        return ptr;
+    }
+
+    template<typename...Args>
+    static PromisePtr<T> resolve(Executor* executor, Args&&...args) {
+        auto ptr = make(executor);
+        ptr->resolve_impl(std::forward<Args>(args)...);
+        return ptr;
+    }
+
+    static PromisePtr<T> reject(Executor* executor, std::exception_ptr eptr = nullptr) {
+        auto ptr = make(executor);
+        ptr->reject_impl(std::move(eptr));
+        return ptr;
+    }
+
+    // Resolves once every input of a range of PromisePtr<U> has, with their
+    // values by index in a PromisePtr<std::vector<U>> (PromisePtr<> when U is
+    // void), or rejects with the first rejection. The values are moved out
+    template<typename Range, constraint<IsRange<Range>::value> = 0>
+    static auto all(Executor* executor, const Range& range) {
+        using U = detail::RangePromiseValue<Range>;
+        using Out = std::conditional_t<std::is_void_v<U>, void, std::vector<detail::ValueOf<U>>>;
+
+        return combine<U, Out, std::optional<detail::ValueOf<U>>>(executor, range,
+            [](auto& agg, size_t index, Promise<U>* input) {
+                if (input->state() == Resolved) {
+                    if constexpr (!std::is_void_v<U>) {
+                        agg[index].emplace(std::move(*input->value_));
+                    }
+                } else if (agg.decide()) {
+                    agg.defer().reject(input->eptr_);
+                }
+            },
+            [](auto& agg) {
+                if constexpr (std::is_void_v<U>) {
+                    agg.defer().resolve();
+                } else {
+                    Out values;
+                    values.reserve(agg.size());
+                    for (auto& slot : agg) {
+                        values.push_back(std::move(*slot));
+                    }
+                    agg.defer().resolve(std::move(values));
+                }
+            });
+    }
+
+    // Resolves once every input has settled, with a
+    // PromisePtr<std::vector<Settled<U>>> by index. Never rejects
+    template<typename Range, constraint<IsRange<Range>::value> = 0>
+    static auto all_settled(Executor* executor, const Range& range) {
+        using U = detail::RangePromiseValue<Range>;
+        using Out = std::vector<Settled<U>>;
+
+        return combine<U, Out, Settled<U>>(executor, range,
+            [](auto& agg, size_t index, Promise<U>* input) {
+                if (input->state() != Resolved) {
+                    agg[index].eptr = input->eptr_;
+                } else if constexpr (std::is_void_v<U>) {
+                    agg[index].value.emplace();
+                } else {
+                    agg[index].value.emplace(std::move(*input->value_));
+                }
+            },
+            [](auto& agg) {
+                agg.defer().resolve(std::make_move_iterator(agg.begin()), std::make_move_iterator(agg.end()));
+            });
+    }
+
+    // Resolves with the first input to resolve, as its index in a PromisePtr<size_t>
+    // or as PromisePtr<std::pair<size_t, U>>. Rejects with AllRejected if none does
+    template<typename Range, constraint<IsRange<Range>::value> = 0>
+    static auto any(Executor* executor, const Range& range) {
+        using U = detail::RangePromiseValue<Range>;
+        using Out = std::conditional_t<std::is_void_v<U>, size_t, std::pair<size_t, detail::ValueOf<U>>>;
+
+        return combine<U, Out, std::exception_ptr>(executor, range,
+            [](auto& agg, size_t index, Promise<U>* input) {
+                if (input->state() != Resolved) {
+                    agg[index] = input->eptr_;
+                } else if (agg.decide()) {
+                    if constexpr (std::is_void_v<U>) {
+                        agg.defer().resolve(index);
+                    } else {
+                        agg.defer().resolve(index, std::move(*input->value_));
+                    }
+                }
+            },
+            [](auto& agg) {
+                AllRejected error;
+                error.reasons.assign(std::make_move_iterator(agg.begin()), std::make_move_iterator(agg.end()));
+                agg.defer().reject(std::make_exception_ptr(std::move(error)));
+            });
+    }
+
+    // settles as the first input to settle does
+    template<typename Range, constraint<IsRange<Range>::value> = 0>
+    static PromisePtr<> race(Executor* executor, const Range& range) {
+        using U = detail::RangePromiseValue<Range>;
+
+        return combine<U, void, detail::Void>(executor, range,
+            [](auto& agg, size_t, Promise<U>* input) {
+                if (!agg.decide()) {
+                    return;
+                }
+                if (input->state() == Resolved) {
+                    agg.defer().resolve();
+                } else {
+                    agg.defer().reject(input->eptr_);
+                }
+            },
+            [](auto&) { });
+    }
+
+    // Applies to the continuations that run after this call,
+    // and is inherited by the promises then() / fail() return
+    PromisePtr<T> set_dispatch(Dispatch dispatch) {
+        dispatch_.store(dispatch, std::memory_order_relaxed);
+        return share();
+    }
+
+    // the same for the lane continuations are posted to
+    PromisePtr<T> set_priority(Priority priority) {
+        priority_.store(priority, std::memory_order_relaxed);
+        return share();
+    }
+
+    // on_resolved(T&&) -> R, on_rejected(std::exception_ptr) -> R,
+    // returns PromisePtr<R>, or PromisePtr<U> when R is PromisePtr<U>
+    template<typename OnResolved, typename OnRejected>
+    auto then(OnResolved on_resolved, OnRejected on_rejected) {
+        using U = typename detail::Unwrap<typename detail::ResolvedResult<OnResolved, T>::Type>::Type;
+        return chain<U>(both_handler<U>(std::move(on_resolved), std::move(on_rejected)));
+    }
 
-        return new_promise;
+    // rejections pass through to the returned promise
+    template<typename OnResolved>
+    auto then(OnResolved on_resolved) {
+        using U = typename detail::Unwrap<typename detail::ResolvedResult<OnResolved, T>::Type>::Type;
+        return chain<U>(resolved_handler<U>(std::move(on_resolved)));
     }
 
+    // on_rejected may recover with a T, or return nothing and give up the value
     template<typename OnRejected>
-    PromisePtr fail(OnRejected on_rejected) {
-        auto new_promise = sync_spawn(
-            executor_, 
-            [
-                ptr = shared_from_this(),
-                on_rejected = std::move(on_rejected)
-            ](Defer defer) mutable {
-                std::lock_guard lk(ptr->mutex_);
-                ptr->resolve_fns_.emplace_back(func_impl(defer, [] {}, true));
-                ptr->reject_fns_.emplace_back(func_impl(defer, std::move(on_rejected), true));
-            }
-        );
+    auto fail(OnRejected on_rejected) {
+        using U = typename detail::Unwrap<typename detail::RejectedResult<OnRejected>::Type>::Type;
+        return chain<U>(rejected_handler<U>(std::move(on_rejected)));
+    }
+
+    // The same, cancelled by token: a handler that hasn't started by then
+    // is skipped and destroyed, and the returned promise rejects with
+    // Cancelled right away instead of waiting for this one
 
-        return new_promise;
+    template<typename OnResolved, typename OnRejected>
+    auto then(const CancellationToken& token, OnResolved on_resolved, OnRejected on_rejected) {
+        using U = typename detail::Unwrap<typename detail::ResolvedResult<OnResolved, T>::Type>::Type;
+        return chain<U>(token, both_handler<U>(std::move(on_resolved), std::move(on_rejected)));
     }
 
-    State state() {
-        return state_;
+    template<typename OnResolved>
+    auto then(const CancellationToken& token, OnResolved on_resolved) {
+        using U = typename detail::Unwrap<typename detail::ResolvedResult<OnResolved, T>::Type>::Type;
+        return chain<U>(token, resolved_handler<U>(std::move(on_resolved)));
+    }
+
+    template<typename OnRejected>
+    auto fail(const CancellationToken& token, OnRejected on_rejected) {
+        using U = typename detail::Unwrap<typename detail::RejectedResult<OnRejected>::Type>::Type;
+        return chain<U>(token, rejected_handler<U>(std::move(on_rejected)));
     }
 
 private:
-    static PromisePtr sync_spawn(Executor* executor, std::function<void(Defer)>&& fn) {
+    // trace_parent is the promise a chained one follows, 0 for the running task
+    static PromisePtr<T> make(
+        Executor* executor,
+        Dispatch dispatch = Dispatch::Post,
+        Priority priority = Priority::Normal,
+        uint64_t trace_parent = 0)
+    {
         MAGIO_NEW_PROMISE;
-        std::shared_ptr<Promise> ptr(new Promise(executor), 
-            [](Promise* p) {
-                MAGIO_DESTROY_PROMISE;
-                delete p;
-            });
-
-        fn(Defer(ptr));
+        PromisePtr<T> ptr(ObjectPool<Promise>::create(executor, dispatch, priority));
+        ptr->trace_id_ = PromiseTrace::on_spawn(trace_parent);
         return ptr;
     }
 
-    template<typename Fn>
-    static auto func_impl(const Defer& defer, Fn&& fn, bool flag) {
+    // the continuations of then() and fail(), fn(self, defer) for chain()
+
+    template<typename U, typename OnResolved, typename OnRejected>
+    static auto both_handler(OnResolved on_resolved, OnRejected on_rejected) {
+        static_assert(
+            std::is_same_v<
+                typename detail::ResolvedResult<OnResolved, T>::Type,
+                typename detail::RejectedResult<OnRejected>::Type>,
+            "on_resolved and on_rejected must return the same type");
+
         return [
-            defer,
-            fn = std::forward<Fn>(fn),
-            flag
-        ]() mutable {
-            if constexpr(std::is_same_v<PromisePtr, std::invoke_result_t<std::decay_t<Fn>>>) {
-                auto ptr = fn();
-                ptr->then(
-                    [defer] {
-                        defer.resolve();
-                    },
-                    [defer] {
-                        defer.reject();
-                    });
+            on_resolved = std::move(on_resolved),
+            on_rejected = std::move(on_rejected)
+        ](Promise* self, Defer<U>& defer) mutable {
+            if (self->state() == Resolved) {
+                settle_with(defer, [&] { return self->invoke_resolved(on_resolved); });
             } else {
-                fn();
-                if (flag) {
+                settle_with(defer, [&] { return invoke_rejected(on_rejected, self->eptr_); });
+            }
+        };
+    }
+
+    template<typename U, typename OnResolved>
+    static auto resolved_handler(OnResolved on_resolved) {
+        return [on_resolved = std::move(on_resolved)](Promise* self, Defer<U>& defer) mutable {
+            if (self->state() == Resolved) {
+                settle_with(defer, [&] { return self->invoke_resolved(on_resolved); });
+            } else {
+                defer.reject(self->eptr_);
+            }
+        };
+    }
+
+    template<typename U, typename OnRejected>
+    static auto rejected_handler(OnRejected on_rejected) {
+        static_assert(
+            std::is_void_v<U> || std::is_same_v<T, U>,
+            "on_rejected must return void or the value type of the promise");
+
+        return [on_rejected = std::move(on_rejected)](Promise* self, Defer<U>& defer) mutable {
+            if (self->state() == Resolved) {
+                if constexpr (std::is_void_v<U>) {
                     defer.resolve();
                 } else {
-                    defer.reject();
+                    defer.resolve(std::move(*self->value_));
                 }
+            } else {
+                settle_with(defer, [&] { return invoke_rejected(on_rejected, self->eptr_); });
             }
         };
     }
 
-    void resolve_impl() {
-        std::lock_guard lk(mutex_);
-        if (state_ != Pending) {
+    // fn(Defer<U>&) or fn(self, Defer<U>&) wrapped for token, see CancellableCall
+    template<typename Fn, typename U>
+    static auto make_cancellable(const CancellationToken& token, Fn&& fn, Defer<U> defer) {
+        using Call = detail::CancellableCall<std::decay_t<Fn>, U>;
+
+        auto call = std::make_shared<Call>(std::forward<Fn>(fn), std::move(defer));
+        call->registration = token.on_cancel([weak = std::weak_ptr<Call>(call)] {
+            if (auto call = weak.lock()) {
+                call->cancel();
+            }
+        });
+        return call;
+    }
+
+    // Attaches on_settled(agg, index, input) to every input of the range and
+    // calls on_last(agg) when the last one has settled, unless an input has
+    // settled the output early with agg.decide()
+    template<typename U, typename Out, typename Slot, typename Range, typename OnSettled, typename OnLast>
+    static PromisePtr<Out> combine(Executor* executor, const Range& range, OnSettled on_settled, OnLast on_last) {
+        using Agg = detail::Aggregate<Slot, Out>;
+
+        auto out = Promise<Out>::make(executor);
+        auto agg = Agg::create(std::distance(range.begin(), range.end()), Defer<Out>(out));
+        if (agg->size() == 0) {
+            on_last(*agg);
+            agg->destroy();
+            return out;
+        }
+
+        // inputs that have already settled are posted in batches
+        PostBatch batch;
+        size_t index = 0;
+        for (auto& ptr : range) {
+            ptr->attach([agg, index = index++, on_settled, on_last](detail::PromiseBase* base) mutable {
+                on_settled(*agg, index, static_cast<Promise<U>*>(base));
+                if (agg->arrive()) {
+                    if (!agg->decided()) {
+                        on_last(*agg);
+                    }
+                    agg->destroy();
+                }
+            }, batch);
+        }
+        return out;
+    }
+
+    PromisePtr<T> share() {
+        add_ref();
+        return PromisePtr<T>(this);
+    }
+
+    void add_ref() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            MAGIO_DESTROY_PROMISE;
+            ObjectPool<Promise>::destroy(this);
+        }
+    }
+
+    // Creates the next promise of a chain and attaches
+    // fn(this, defer) as the continuation that settles it
+    template<typename U, typename Fn>
+    PromisePtr<U> chain(Fn&& fn) {
+        auto next = Promise<U>::make(executor_, dispatch_policy(), priority(), trace_id_);
+        attach([defer = Defer<U>(next), fn = std::forward<Fn>(fn)](detail::PromiseBase* base) mutable {
+            fn(static_cast<Promise*>(base), defer);
+        });
+        return next;
+    }
+
+    // as chain(), the continuation is dropped if token is cancelled first
+    template<typename U, typename Fn>
+    PromisePtr<U> chain(const CancellationToken& token, Fn&& fn) {
+        auto next = Promise<U>::make(executor_, dispatch_policy(), priority(), trace_id_);
+        auto call = make_cancellable(token, std::forward<Fn>(fn), Defer<U>(next));
+        attach([call](detail::PromiseBase* base) {
+            if (auto fn = call->take()) {
+                (*fn)(static_cast<Promise*>(base), call->defer);
+            }
+        });
+        return next;
+    }
+
+    template<typename Fn>
+    void attach(Fn&& fn) {
+        auto node = ObjectPool<detail::Continuation>::create(
+            detail::Continuation{nullptr, std::forward<Fn>(fn)});
+        if (!push_continuation(node)) {
+            dispatch(node);
+        }
+    }
+
+    // as attach(), but a continuation that can run at once goes into batch
+    template<typename Fn>
+    void attach(Fn&& fn, PostBatch& batch) {
+        auto node = ObjectPool<detail::Continuation>::create(
+            detail::Continuation{nullptr, std::forward<Fn>(fn)});
+        if (!push_continuation(node)) {
+            dispatch(node, batch);
+        }
+    }
+
+    // the caller holds a reference, so an inline run needs none of its own
+    void dispatch(detail::Continuation* node) {
+        if (can_run_inline()) {
+            InlineScope scope;
+            TraceRun run(PromiseTrace::on_inline(trace_id_), trace_id_);
+            detail::ContinuationPtr(node)->fn(this);
+            return;
+        }
+
+        executor_->post(continuation_task(node), priority());
+    }
+
+    void dispatch(detail::Continuation* node, PostBatch& batch) {
+        if (can_run_inline()) {
+            InlineScope scope;
+            TraceRun run(PromiseTrace::on_inline(trace_id_), trace_id_);
+            detail::ContinuationPtr(node)->fn(this);
             return;
         }
-        state_ = Resolved;
 
-        for (auto& fn : resolve_fns_) {
-            executor_->post(std::move(fn));
+        // batches only hold Normal tasks
+        if (priority() != Priority::Normal) {
+            executor_->post(continuation_task(node), priority());
+            return;
         }
+        batch.push(executor_, continuation_task(node));
+    }
+
+    Task continuation_task(detail::Continuation* node) {
+        return [node = detail::ContinuationPtr(node), self = share(), task = PromiseTrace::on_post(trace_id_)]() mutable {
+            TraceRun run(task, self->trace_id_);
+            node->fn(self.get());
+        };
     }
 
-    void reject_impl() {
-        std::lock_guard lk(mutex_);
-        if (state_ != Pending) {
+    template<typename...Args>
+    void resolve_impl(Args&&...args) {
+        if (!claim()) {
             return;
         }
-        state_ = Rejected;
-        
-        for (auto& fn : reject_fns_) {
-            executor_->post(std::move(fn));
+
+        if constexpr (!std::is_void_v<T>) {
+            value_.emplace(std::forward<Args>(args)...);
         }
+        PromiseTrace::on_settle(trace_id_, true);
+        run_continuations(publish(Resolved));
     }
 
-    std::mutex mutex_;
+    void reject_impl(std::exception_ptr eptr) {
+        if (!claim()) {
+            return;
+        }
 
-    Executor* executor_;
-    State state_ = Pending;
-    std::exception_ptr eptr_;
+        eptr_ = std::move(eptr);
+        PromiseTrace::on_settle(trace_id_, false);
+        run_continuations(publish(Rejected));
+    }
+
+    // a promise with many listeners posts them kPostBatchSize at a time
+    void run_continuations(detail::Continuation* head) {
+        PostBatch batch;
+        while (head) {
+            dispatch(std::exchange(head, head->next), batch);
+        }
+    }
 
-    std::vector<std::function<void()>> resolve_fns_;
-    std::vector<std::function<void()>> reject_fns_;
+    // settles defer with this promise once it settles,
+    // used when a handler returns a promise
+    void forward_to(Defer<T> defer) {
+        attach([defer = std::move(defer)](detail::PromiseBase* base) {
+            auto self = static_cast<Promise*>(base);
+            if (self->state() == Resolved) {
+                if constexpr (std::is_void_v<T>) {
+                    defer.resolve();
+                } else {
+                    defer.resolve(std::move(*self->value_));
+                }
+            } else {
+                defer.reject(self->eptr_);
+            }
+        });
+    }
+
+    template<typename Fn>
+    decltype(auto) invoke_resolved(Fn& fn) {
+        if constexpr (std::is_void_v<T>) {
+            return fn();
+        } else if constexpr (std::is_invocable_v<Fn&, T&&>) {
+            return fn(std::move(*value_));
+        } else {
+            return fn();
+        }
+    }
+
+    template<typename Fn>
+    static decltype(auto) invoke_rejected(Fn& fn, const std::exception_ptr& eptr) {
+        if constexpr (std::is_invocable_v<Fn&, std::exception_ptr>) {
+            return fn(eptr);
+        } else {
+            return fn();
+        }
+    }
+
+    // settles defer with what fn returns, or rejects it with what fn throws
+    template<typename U, typename Fn>
+    static void settle_with(Defer<U>& defer, Fn&& fn) {
+        using Result = std::invoke_result_t<Fn>;
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                fn();
+                defer.resolve();
+            } else if constexpr (detail::IsPromisePtr<Result>::value) {
+                fn()->forward_to(std::move(defer));
+            } else {
+                defer.resolve(fn());
+            }
+        } catch(...) {
+            defer.reject(std::current_exception());
+        }
+    }
+
+    std::optional<detail::ValueOf<T>> value_;
 };
 
-void Defer::resolve() const {
-    promise_->resolve_impl();
+template<typename T>
+PromisePtr<T>::PromisePtr(const PromisePtr& other) noexcept
+    : ptr_(other.ptr_)
+{
+    if (ptr_) {
+        ptr_->add_ref();
+    }
+}
+
+template<typename T>
+PromisePtr<T>::~PromisePtr() {
+    if (ptr_) {
+        ptr_->release();
+    }
+}
+
+template<typename T>
+template<typename...Args>
+void Defer<T>::resolve(Args&&...args) const {
+    promise_->resolve_impl(std::forward<Args>(args)...);
 }
 
-void Defer::reject() const {
-    promise_->reject_impl();
+template<typename T>
+void Defer<T>::reject(std::exception_ptr eptr) const {
+    promise_->reject_impl(std::move(eptr));
 }
 
 // timer
 
 template<typename Exe, typename Rep, typename Per>
-PromisePtr sleep_for(Exe* exe, const std::chrono::duration<Rep, Per>& dur) {
-    return Promise::spawn(exe, [dur, exe](Defer defer) {
+PromisePtr<> sleep_for(Exe* exe, const std::chrono::duration<Rep, Per>& dur) {
+    return Promise<>::spawn(exe, [dur, exe](Defer<> defer) {
         exe->expires_after(dur, [defer](bool) {
             defer.resolve();
         });
@@ -263,14 +1000,38 @@ PromisePtr sleep_for(Exe* exe, const std::chrono::duration<Rep, Per>& dur) {
 }
 
 template<typename Exe>
-PromisePtr sleep_until(Exe* exe, const std::chrono::steady_clock::time_point& tp) {
-    return Promise::spawn(exe, [tp, exe](Defer defer) {
-        exe->expires_after(tp, [defer](bool) {
+PromisePtr<> sleep_until(Exe* exe, const std::chrono::steady_clock::time_point& tp) {
+    return Promise<>::spawn(exe, [tp, exe](Defer<> defer) {
+        exe->expires_until(tp, [defer](bool) {
             defer.resolve();
         });
     });
 }
 
+// cancelling token cancels the timer, the promise rejects with Cancelled
+template<typename Exe, typename Rep, typename Per>
+PromisePtr<> sleep_for(Exe* exe, const std::chrono::duration<Rep, Per>& dur, const CancellationToken& token) {
+    return sleep_until(exe, TimerClock::now() + dur, token);
+}
+
+template<typename Exe>
+PromisePtr<> sleep_until(Exe* exe, const std::chrono::steady_clock::time_point& tp, const CancellationToken& token) {
+    return Promise<>::spawn(exe, token, [tp, exe, token](Defer<> defer) {
+        // released by the timer task, or right below if it has already run
+        auto registration = std::make_shared<CancellationRegistration>();
+        auto handle = exe->expires_until(tp, [defer, registration](bool expired) {
+            if (expired) {
+                defer.resolve();
+            } else {
+                defer.reject(std::make_exception_ptr(Cancelled()));
+            }
+        });
+        *registration = token.on_cancel([exe, handle] {
+            exe->cancel(handle);
+        });
+    });
+}
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "magio/core/promise_trace.h"
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <system_error>
+#include <unordered_map>
+
+#include "fmt/format.h"
+
+#include "magio/core/current_thread.h"
+
+namespace magio {
+
+namespace {
+
+struct TraceRecord {
+    uint64_t ts;
+    uint64_t id;
+    uint64_t parent;
+    uint64_t arg;
+    TraceEvent event;
+};
+
+// One thread's events. Its owner writes the slots seqlock style, so dump()
+// can read them at any time and skip the ones being overwritten
+class TraceRing: Noncopyable {
+public:
+    TraceRing(size_t size, size_t index)
+        : size_(std::max(size, size_t(1)))
+        , index_(index)
+        , thread_(CurrentThread::get_id())
+        , slots_(std::make_unique<Slot[]>(size_)) { }
+
+    void push(const TraceRecord& record) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        auto& slot = slots_[head % size_];
+
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.ts.store(record.ts, std::memory_order_relaxed);
+        slot.id.store(record.id, std::memory_order_relaxed);
+        slot.parent.store(record.parent, std::memory_order_relaxed);
+        slot.arg.store(record.arg << 8 | (uint64_t)record.event, std::memory_order_relaxed);
+        slot.seq.store(head + 1, std::memory_order_release);
+
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // the records since the last clear() that are still in the ring
+    void read(std::vector<TraceRecord>& out) const {
+        uint64_t head = head_.load(std::memory_order_acquire);
+        uint64_t first = std::max(begin_.load(std::memory_order_relaxed), head > size_ ? head - size_ : 0);
+
+        for (uint64_t i = first; i < head; ++i) {
+            auto& slot = slots_[i % size_];
+            if (slot.seq.load(std::memory_order_acquire) != i + 1) {
+                continue;
+            }
+
+            TraceRecord record;
+            record.ts = slot.ts.load(std::memory_order_relaxed);
+            record.id = slot.id.load(std::memory_order_relaxed);
+            record.parent = slot.parent.load(std::memory_order_relaxed);
+            uint64_t arg = slot.arg.load(std::memory_order_relaxed);
+            record.arg = arg >> 8;
+            record.event = (TraceEvent)(arg & 0xff);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == i + 1) {
+                out.push_back(record);
+            }
+        }
+    }
+
+    void clear() {
+        begin_.store(head_.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+
+    uint64_t next_id() {
+        return (uint64_t)(index_ + 1) << 40 | ++last_id_;
+    }
+
+    size_t index() const {
+        return index_;
+    }
+
+    const std::string& thread() const {
+        return thread_;
+    }
+
+private:
+    struct Slot {
+        // 1 + the position of the record it holds, 0 while it is written
+        std::atomic_uint64_t seq = 0;
+        std::atomic_uint64_t ts = 0;
+        std::atomic_uint64_t id = 0;
+        std::atomic_uint64_t parent = 0;
+        // arg << 8 | event
+        std::atomic_uint64_t arg = 0;
+    };
+
+    const size_t size_;
+    const size_t index_;
+    const std::string thread_;
+    std::unique_ptr<Slot[]> slots_;
+
+    std::atomic_uint64_t head_ = 0;
+    std::atomic_uint64_t begin_ = 0;
+    // owner only
+    uint64_t last_id_ = 0;
+};
+
+struct TraceRings {
+    std::mutex m;
+    // rings outlive their threads, so a dump still has their events
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    std::atomic_size_t ring_size = kTraceRingSize;
+};
+
+TraceRings& trace_rings() {
+    static TraceRings rings;
+    return rings;
+}
+
+TraceRing& local_ring() {
+    static thread_local std::shared_ptr<TraceRing> ring = [] {
+        auto& rings = trace_rings();
+        std::lock_guard lk(rings.m);
+        auto ring = std::make_shared<TraceRing>(
+            rings.ring_size.load(std::memory_order_relaxed), rings.rings.size());
+        rings.rings.push_back(ring);
+        return ring;
+    }();
+    return *ring;
+}
+
+// microseconds, what the trace event format counts in
+double us(uint64_t ns) {
+    return (double)ns / 1000;
+}
+
+void write_events(fmt::memory_buffer& buf, const TraceRing& ring, const std::vector<TraceRecord>& records,
+    const std::unordered_map<uint64_t, uint64_t>& posted_at)
+{
+    auto out = std::back_inserter(buf);
+    size_t tid = ring.index() + 1;
+
+    fmt::format_to(out,
+        "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+        tid, ring.thread());
+
+    for (auto& r : records) {
+        switch (r.event) {
+        case TraceEvent::Spawn:
+            fmt::format_to(out,
+                ",\n{{\"name\":\"promise\",\"cat\":\"promise\",\"ph\":\"b\",\"id\":\"0x{:x}\",\"pid\":1,\"tid\":{},"
+                "\"ts\":{:.3f},\"args\":{{\"parent\":\"0x{:x}\"}}}}",
+                r.id, tid, us(r.ts), r.parent);
+            break;
+        case TraceEvent::Settle:
+            fmt::format_to(out,
+                ",\n{{\"name\":\"promise\",\"cat\":\"promise\",\"ph\":\"e\",\"id\":\"0x{:x}\",\"pid\":1,\"tid\":{},"
+                "\"ts\":{:.3f},\"args\":{{\"state\":\"{}\",\"task\":\"0x{:x}\"}}}}",
+                r.id, tid, us(r.ts), r.arg == 1 ? "resolved" : "rejected", r.parent);
+            break;
+        case TraceEvent::Post:
+            fmt::format_to(out,
+                ",\n{{\"name\":\"post\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":{},"
+                "\"ts\":{:.3f},\"args\":{{\"task\":\"0x{:x}\",\"promise\":\"0x{:x}\"}}}}",
+                tid, us(r.ts), r.id, r.parent);
+            fmt::format_to(out,
+                ",\n{{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"s\",\"id\":\"0x{:x}\",\"pid\":1,\"tid\":{},\"ts\":{:.3f}}}",
+                r.id, tid, us(r.ts));
+            break;
+        case TraceEvent::Run: {
+            auto it = posted_at.find(r.id);
+            fmt::format_to(out,
+                ",\n{{\"name\":\"run\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+                "\"dur\":{:.3f},\"args\":{{\"task\":\"0x{:x}\",\"promise\":\"0x{:x}\"",
+                tid, us(r.ts), us(r.arg), r.id, r.parent);
+            if (it != posted_at.end()) {
+                fmt::format_to(out, ",\"queued_us\":{:.3f}}}}}", us(r.ts - std::min(r.ts, it->second)));
+                fmt::format_to(out,
+                    ",\n{{\"name\":\"queued\",\"cat\":\"task\",\"ph\":\"f\",\"bp\":\"e\",\"id\":\"0x{:x}\",\"pid\":1,"
+                    "\"tid\":{},\"ts\":{:.3f}}}",
+                    r.id, tid, us(r.ts));
+            } else {
+                fmt::format_to(out, "}}}}");
+            }
+            break;
+        }
+        }
+    }
+}
+
+}
+
+void PromiseTrace::start(size_t events_per_thread) {
+    trace_rings().ring_size.store(events_per_thread, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void PromiseTrace::stop() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void PromiseTrace::clear() {
+    auto& rings = trace_rings();
+    std::lock_guard lk(rings.m);
+    for (auto& ring : rings.rings) {
+        ring->clear();
+    }
+}
+
+void PromiseTrace::dump(const std::string& path) {
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+        auto& all = trace_rings();
+        std::lock_guard lk(all.m);
+        rings = all.rings;
+    }
+
+    std::vector<std::vector<TraceRecord>> records(rings.size());
+    std::unordered_map<uint64_t, uint64_t> posted_at;
+    for (size_t i = 0; i < rings.size(); ++i) {
+        rings[i]->read(records[i]);
+        for (auto& r : records[i]) {
+            if (r.event == TraceEvent::Post) {
+                posted_at.emplace(r.id, r.ts);
+            }
+        }
+    }
+
+    fmt::memory_buffer buf;
+    fmt::format_to(std::back_inserter(buf), "{{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < rings.size(); ++i) {
+        if (i > 0) {
+            fmt::format_to(std::back_inserter(buf), ",\n");
+        }
+        write_events(buf, *rings[i], records[i], posted_at);
+    }
+    fmt::format_to(std::back_inserter(buf), "\n]}}\n");
+
+    auto file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    bool written = std::fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+    int err = errno;
+    if (std::fclose(file) != 0 && written) {
+        err = errno;
+        written = false;
+    }
+    if (!written) {
+        throw std::system_error(err, std::generic_category(), path);
+    }
+}
+
+uint64_t PromiseTrace::record(TraceEvent event, uint64_t parent) {
+    auto& ring = local_ring();
+    uint64_t id = ring.next_id();
+    ring.push({now(), id, parent, 0, event});
+    return id;
+}
+
+void PromiseTrace::record(TraceEvent event, uint64_t ts, uint64_t id, uint64_t parent, uint64_t arg) {
+    local_ring().push({ts, id, parent, arg, event});
+}
+
+uint64_t PromiseTrace::next_id() {
+    return local_ring().next_id();
+}
+
+uint64_t PromiseTrace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
\ No newline at end of file
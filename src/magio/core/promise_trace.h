@@ -0,0 +1,145 @@
+#ifndef MAGIO_CORE_PROMISE_TRACE_H_
+#define MAGIO_CORE_PROMISE_TRACE_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <utility>
+
+#include "magio/core/noncopyable.h"
+
+// 0 compiles the promise hooks out, PromiseTrace then records nothing.
+// With 1 they cost a relaxed load until PromiseTrace::start()
+#ifndef MAGIO_PROMISE_TRACE
+#define MAGIO_PROMISE_TRACE 1
+#endif
+
+namespace magio {
+
+// events each thread keeps, older ones are overwritten
+constexpr size_t kTraceRingSize = 1 << 16;
+
+enum class TraceEvent: uint8_t {
+    // a promise is made, its parent is the promise it chains to,
+    // else the task that made it
+    Spawn,
+    // a promise resolves or rejects, its parent is the task that settled it
+    Settle,
+    // a continuation or a spawn()ed function is posted, its parent is the promise
+    Post,
+    // it has run, on the thread that ran it
+    Run
+};
+
+// Records the lifecycle of the promises made while it is on into a lock
+// free ring per thread, and writes them as Chrome trace event JSON, which
+// Perfetto and chrome://tracing load. A promise is an async slice from
+// spawn to settle, a task is a slice on the thread that ran it, with a
+// flow arrow from where it was posted and its queueing delay in its args
+class PromiseTrace {
+    friend class TraceRun;
+
+public:
+    // events_per_thread applies to the threads that record for the first time
+    static void start(size_t events_per_thread = kTraceRingSize);
+
+    static void stop();
+
+    static bool enabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Writes what the rings hold, they may still be written meanwhile.
+    // Throws std::system_error if path can't be written
+    static void dump(const std::string& path);
+
+    // drops what has been recorded so far
+    static void clear();
+
+    // The hooks of Promise. They return 0 and record nothing while tracing
+    // is off, and nothing for the promises made before it was on
+
+    // the id of a new promise
+    static uint64_t on_spawn(uint64_t parent) {
+#if MAGIO_PROMISE_TRACE
+        if (enabled()) {
+            return record(TraceEvent::Spawn, parent ? parent : task_);
+        }
+#endif
+        return 0;
+    }
+
+    static void on_settle(uint64_t promise, bool resolved) {
+#if MAGIO_PROMISE_TRACE
+        if (promise && enabled()) {
+            record(TraceEvent::Settle, now(), promise, task_, resolved ? 1 : 2);
+        }
+#endif
+    }
+
+    // the id of a task posted for promise, for its TraceRun
+    static uint64_t on_post(uint64_t promise) {
+#if MAGIO_PROMISE_TRACE
+        if (promise && enabled()) {
+            return record(TraceEvent::Post, promise);
+        }
+#endif
+        return 0;
+    }
+
+    // the same for a continuation that runs inline, without a Post
+    static uint64_t on_inline(uint64_t promise) {
+#if MAGIO_PROMISE_TRACE
+        if (promise && enabled()) {
+            return next_id();
+        }
+#endif
+        return 0;
+    }
+
+private:
+    // records an event at now under a new id, returns the id
+    static uint64_t record(TraceEvent event, uint64_t parent);
+
+    static void record(TraceEvent event, uint64_t ts, uint64_t id, uint64_t parent, uint64_t arg);
+
+    static uint64_t next_id();
+
+    static uint64_t now();
+
+    inline static std::atomic_bool enabled_ = false;
+
+    // the task running on this thread, 0 outside of one
+    inline static thread_local uint64_t task_ = 0;
+};
+
+// Marks task as running on this thread while it lives and records
+// its Run event when it ends. Does nothing for task 0
+class TraceRun: Noncopyable {
+public:
+    TraceRun(uint64_t task, uint64_t promise)
+        : task_(task), promise_(promise)
+    {
+        if (task_) {
+            prev_ = std::exchange(PromiseTrace::task_, task_);
+            begin_ = PromiseTrace::now();
+        }
+    }
+
+    ~TraceRun() {
+        if (task_) {
+            PromiseTrace::task_ = prev_;
+            PromiseTrace::record(TraceEvent::Run, begin_, task_, promise_, PromiseTrace::now() - begin_);
+        }
+    }
+
+private:
+    uint64_t task_;
+    uint64_t promise_;
+    uint64_t prev_ = 0;
+    uint64_t begin_ = 0;
+};
+
+}
+
+#endif
\ No newline at end of file
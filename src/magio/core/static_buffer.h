@@ -2,6 +2,7 @@
 #define MAGIO_CORE_STATIC_BUFFER_H_
 
 #include <string>
+#include <algorithm>
 
 #include "fmt/core.h"
 
@@ -21,10 +22,13 @@ public:
         return cplen;
     }
 
+    // truncates what doesn't fit, returns how much was appended
     size_t append_format(std::string_view fmt, fmt::format_args args) {
         auto sv = fmt::vformat_to_n(buf_ + size_, rest(), fmt, args);
-        size_ += sv.size;
-        return sv.size;
+        // sv.size is the untruncated length
+        size_t len = std::min(sv.size, rest());
+        size_ += len;
+        return len;
     }
 
     size_t rest() {
@@ -0,0 +1,115 @@
+#include "magio/core/strand.h"
+
+#include <utility>
+
+#include "magio/core/logger.h"
+#include "magio/core/object_pool.h"
+
+namespace magio {
+
+Strand::~Strand() {
+    auto node = head_.exchange(nullptr, std::memory_order_acquire);
+    if (node == running()) {
+        node = nullptr;
+    }
+
+    for (auto list : {node, ready_}) {
+        while (list) {
+            ObjectPool<Node>::destroy(std::exchange(list, list->next));
+        }
+    }
+}
+
+void Strand::post(Task&& task) {
+    auto node = ObjectPool<Node>::create(Node{nullptr, std::move(task)});
+    push(node, node);
+}
+
+void Strand::post_bulk(Task* tasks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    // newest first, like the stack
+    Node* first = nullptr;
+    Node* last = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        first = ObjectPool<Node>::create(Node{first, std::move(tasks[i])});
+        if (!last) {
+            last = first;
+        }
+    }
+    push(first, last);
+}
+
+TimerHandle Strand::expires_until(const TimerClock::time_point& tp, TimerTask&& task) {
+    return executor_->expires_until(tp, [this, task = std::move(task)](bool expired) mutable {
+        post([task = std::move(task), expired]() mutable {
+            task(expired);
+        });
+    });
+}
+
+bool Strand::cancel(TimerHandle handle) {
+    return executor_->cancel(handle);
+}
+
+void Strand::push(Node* first, Node* last) {
+    auto head = head_.load(std::memory_order_relaxed);
+    do {
+        last->next = head == running() ? nullptr : head;
+    } while (!head_.compare_exchange_weak(head, first, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    // idle before, nobody is going to run it
+    if (head == nullptr) {
+        executor_->post([this] { run(); });
+    }
+}
+
+void Strand::run() {
+    auto prev_strand = std::exchange(local_strand_, this);
+    auto prev_executor = std::exchange(current_, this);
+
+    size_t budget = kStrandBudget;
+    for (; ;) {
+        if (!ready_) {
+            auto node = head_.exchange(running(), std::memory_order_acquire);
+            if (node == running()) {
+                // nothing left, go idle unless a post has come in meanwhile
+                auto expected = running();
+                if (head_.compare_exchange_strong(
+                    expected, nullptr, std::memory_order_release, std::memory_order_relaxed)) {
+                    break;
+                }
+                continue;
+            }
+
+            // the stack is newest first, reverse it for FIFO
+            while (node) {
+                auto next = std::exchange(node->next, ready_);
+                ready_ = std::exchange(node, next);
+            }
+        }
+
+        // more to do, but the worker is shared. head_ stays
+        // non null, so no post schedules another run()
+        if (budget-- == 0) {
+            executor_->post([this] { run(); });
+            break;
+        }
+
+        auto node = std::exchange(ready_, ready_->next);
+        auto task = std::move(node->task);
+        ObjectPool<Node>::destroy(node);
+        try {
+            task();
+        } catch(...) {
+            M_FATAL("{}", "Throw exception when strand task is running");
+        }
+    }
+
+    local_strand_ = prev_strand;
+    current_ = prev_executor;
+}
+
+}
\ No newline at end of file
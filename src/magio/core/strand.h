@@ -0,0 +1,87 @@
+#ifndef MAGIO_CORE_STRAND_H_
+#define MAGIO_CORE_STRAND_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "magio/core/executor.h"
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// how many tasks a strand runs on a worker before it posts itself
+// again, so a busy strand shares the worker with other work
+constexpr size_t kStrandBudget = 64;
+
+// Runs the tasks posted to it one at a time and in the order they were
+// posted, on the threads of the executor it wraps, so state touched only
+// from a strand needs no mutex. Nothing blocks: a post pushes onto a lock
+// free stack, and the first post to an idle strand posts a task to the
+// executor that runs what has queued up back to back. Give a strand to
+// Promise::spawn() and the promises chained to it run their continuations
+// on the strand too. It has to outlive the tasks posted to it
+class Strand final: Noncopyable, public Executor {
+public:
+    explicit Strand(Executor* executor)
+        : executor_(executor) { }
+
+    // drops the tasks that haven't run, with none of them running
+    ~Strand();
+
+    Executor* executor() const {
+        return executor_;
+    }
+
+    // true inside a task of this strand
+    bool running_in_this_thread() const {
+        return local_strand_ == this;
+    }
+
+    using Executor::post;
+
+    void post(Task&& task) override;
+
+    using Executor::post_bulk;
+
+    void post_bulk(Task* tasks, size_t n) override;
+
+    // the timer runs on the wrapped executor and its task on the strand
+    TimerHandle expires_until(const TimerClock::time_point& tp, TimerTask&& task) override;
+
+    // never blocks, a cancelled timer's task is posted to the strand
+    // with false and may run after cancel() has returned
+    bool cancel(TimerHandle handle) override;
+
+private:
+    struct Node {
+        Node* next;
+        Task task;
+    };
+
+    // links [first, last] onto the stack, the first push
+    // to an idle strand schedules run()
+    void push(Node* first, Node* last);
+
+    // runs up to kStrandBudget tasks on a worker of executor_
+    void run();
+
+    // head_ while run() is scheduled or running with nothing pending
+    static Node* running() {
+        return reinterpret_cast<Node*>(uintptr_t(1));
+    }
+
+    Executor* executor_;
+
+    // nullptr while idle, running(), or the newest pending node
+    // with run() scheduled or running. Nodes link newest first
+    std::atomic<Node*> head_ = nullptr;
+
+    // taken off head_ and put in order, touched by run() only
+    Node* ready_ = nullptr;
+
+    inline static thread_local Strand* local_strand_ = nullptr;
+};
+
+}
+
+#endif
\ No newline at end of file
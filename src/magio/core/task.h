@@ -0,0 +1,155 @@
+#ifndef MAGIO_CORE_TASK_H_
+#define MAGIO_CORE_TASK_H_
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+#include "magio/core/traits.h"
+
+namespace magio {
+
+constexpr size_t kTaskBufferSize = 64;
+
+// Move only replacement for std::function. Callables that fit in
+// BufferSize and can be moved without throwing are stored inline,
+// bigger ones fall back to the heap
+template<typename Signature, size_t BufferSize = kTaskBufferSize>
+class BasicTask;
+
+template<typename Ret, typename...Args, size_t BufferSize>
+class BasicTask<Ret(Args...), BufferSize> {
+    static_assert(BufferSize >= sizeof(void*), "The buffer must be able to hold a pointer");
+
+    struct VTable {
+        Ret (*invoke)(void*, Args...);
+        // move construct into dst and destroy src
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template<typename Fn>
+    static constexpr bool kInline = 
+        sizeof(Fn) <= BufferSize && 
+        alignof(Fn) <= alignof(std::max_align_t) && 
+        std::is_nothrow_move_constructible_v<Fn>;
+
+    template<typename Fn>
+    struct InlineOps {
+        static Fn* get(void* buf) {
+            return std::launder(reinterpret_cast<Fn*>(buf));
+        }
+
+        static Ret invoke(void* buf, Args...args) {
+            return (*get(buf))(std::forward<Args>(args)...);
+        }
+
+        static void move(void* dst, void* src) noexcept {
+            ::new (dst) Fn(std::move(*get(src)));
+            get(src)->~Fn();
+        }
+
+        static void destroy(void* buf) noexcept {
+            get(buf)->~Fn();
+        }
+
+        static constexpr VTable vtable{&invoke, &move, &destroy};
+    };
+
+    template<typename Fn>
+    struct HeapOps {
+        static Fn*& get(void* buf) {
+            return *std::launder(reinterpret_cast<Fn**>(buf));
+        }
+
+        static Ret invoke(void* buf, Args...args) {
+            return (*get(buf))(std::forward<Args>(args)...);
+        }
+
+        static void move(void* dst, void* src) noexcept {
+            ::new (dst) Fn*(get(src));
+        }
+
+        static void destroy(void* buf) noexcept {
+            delete get(buf);
+        }
+
+        static constexpr VTable vtable{&invoke, &move, &destroy};
+    };
+
+public:
+    BasicTask() = default;
+
+    BasicTask(std::nullptr_t) { }
+
+    template<
+        typename Fn,
+        constraint<
+            !std::is_same_v<std::decay_t<Fn>, BasicTask> &&
+            std::is_invocable_r_v<Ret, std::decay_t<Fn>&, Args...>
+        > = 0
+    >
+    BasicTask(Fn&& fn) {
+        using Functor = std::decay_t<Fn>;
+        if constexpr (kInline<Functor>) {
+            ::new (buf_) Functor(std::forward<Fn>(fn));
+            vtable_ = &InlineOps<Functor>::vtable;
+        } else {
+            ::new (buf_) Functor*(new Functor(std::forward<Fn>(fn)));
+            vtable_ = &HeapOps<Functor>::vtable;
+        }
+    }
+
+    BasicTask(BasicTask&& other) noexcept {
+        if (other.vtable_) {
+            other.vtable_->move(buf_, other.buf_);
+            vtable_ = std::exchange(other.vtable_, nullptr);
+        }
+    }
+
+    BasicTask& operator=(BasicTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.vtable_) {
+                other.vtable_->move(buf_, other.buf_);
+                vtable_ = std::exchange(other.vtable_, nullptr);
+            }
+        }
+        return *this;
+    }
+
+    BasicTask(const BasicTask&) = delete;
+    BasicTask& operator=(const BasicTask&) = delete;
+
+    ~BasicTask() {
+        reset();
+    }
+
+    Ret operator()(Args...args) {
+        return vtable_->invoke(buf_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const {
+        return vtable_ != nullptr;
+    }
+
+    void reset() {
+        if (vtable_) {
+            vtable_->destroy(buf_);
+            vtable_ = nullptr;
+        }
+    }
+
+private:
+    const VTable* vtable_ = nullptr;
+    alignas(std::max_align_t) unsigned char buf_[BufferSize];
+};
+
+using Task = BasicTask<void()>;
+
+using TimerTask = BasicTask<void(bool)>;
+
+}
+
+#endif
\ No newline at end of file
@@ -1,9 +1,57 @@
 #include "magio/core/thread_pool.h"
 
+#include <iterator>
+#include <algorithm>
+
 #include "magio/core/logger.h"
 
 namespace magio {
 
+StaticThreadPool::StaticThreadPool(size_t thread_num, Placement placement, Schedule schedule)
+    : schedule_(schedule)
+    , workers_(thread_num + 1)
+    , threads_(thread_num + 1)
+{
+    auto& cpu_sets = placement.groups;
+    if (cpu_sets.empty()) {
+        cpu_sets.emplace_back();
+    }
+    // a group without workers would only strand its posts
+    if (cpu_sets.size() > workers_.size()) {
+        cpu_sets.resize(workers_.size());
+    }
+
+    for (auto& cpus : cpu_sets) {
+        for (int cpu : cpus) {
+            if (cpu < 0) {
+                continue;
+            }
+            if ((size_t)cpu >= cpu_group_.size()) {
+                cpu_group_.resize(cpu + 1, -1);
+            }
+            cpu_group_[cpu] = (int)groups_.size();
+        }
+        groups_.push_back(std::make_unique<Group>(std::move(cpus)));
+    }
+
+    for (size_t g = 0; g < groups_.size(); ++g) {
+        auto& group = *groups_[g];
+        group.begin = g * workers_.size() / groups_.size();
+        group.end = (g + 1) * workers_.size() / groups_.size();
+
+        // the workers of a group are the ones in its range, nothing else decides it
+        for (size_t i = group.begin; i < group.end; ++i) {
+            auto& worker = workers_[i];
+            worker.group = g;
+            if (placement.pin_to_cpu && !group.cpus.empty()) {
+                worker.cpus = {group.cpus[(i - group.begin) % group.cpus.size()]};
+            } else {
+                worker.cpus = group.cpus;
+            }
+        }
+    }
+}
+
 StaticThreadPool::~StaticThreadPool() {
     {
         std::lock_guard lk(mutex_);
@@ -26,13 +74,13 @@ void StaticThreadPool::start() {
     
     std::call_once(once_f_, [&] {
         timer_poller_thread_ = std::thread(&StaticThreadPool::poll_timer_queue, this);
-        for (auto& th : threads_) {
-            th = std::thread(&StaticThreadPool::run_in_background, this);
+        for (size_t i = 0; i < threads_.size(); ++i) {
+            threads_[i] = std::thread(&StaticThreadPool::run_in_background, this, i);
         }
     });
     
     cv_.notify_all();
-    timer_cv_.notify_one();
+    notify_timer_poller();
 }
 
 void StaticThreadPool::destroy() {
@@ -44,7 +92,7 @@ void StaticThreadPool::destroy() {
         state_ = PendingDestroy;
     }
     cv_.notify_all();
-    timer_cv_.notify_one();
+    notify_timer_poller();
 
     for (auto& th : threads_) {
         if (th.joinable()) {
@@ -57,66 +105,419 @@ void StaticThreadPool::destroy() {
     }
 }
 
-void StaticThreadPool::post(std::function<void()>&& task) {
-    {
+void StaticThreadPool::post(Task&& task) {
+    post(std::move(task), Priority::Normal);
+}
+
+void StaticThreadPool::post(Task&& task, Priority priority) {
+    size_t lane = (size_t)priority;
+    if (priority != Priority::Normal) {
+        lane_size_[lane].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t posted = stamp();
+    Job job{std::move(task), posted};
+    if (schedule_ == WorkStealing && local_pool_ == this) {
+        auto& worker = workers_[local_index_];
+        size_t depth = worker.tasks[lane].push(std::move(job));
+        if (posted != 0) {
+            worker.metrics.local_depth_max.max(depth);
+        }
+    } else if (!groups_[local_group()]->injected[lane].try_push(std::move(job))) {
         std::lock_guard lk(mutex_);
-        tasks_.push_back(std::move(task));
+        overflow_[lane].push_back(std::move(job));
+        overflow_size_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    notify_parked();
+}
+
+TimerHandle StaticThreadPool::expires_until(const TimerClock::time_point& tp, TimerTask&& task) {
+    TimerHandle handle;
+    bool sooner;
+    {
+        std::lock_guard lk(timer_m_);
+        handle = timer_queue_.push(tp, std::move(task));
+        sooner = tp < poller_deadline_;
+        if (sooner) {
+            poller_deadline_ = tp;
+        }
+    }
+
+    if (sooner) {
+        timer_cv_.notify_one();
+    }
+    return handle;
+}
+
+bool StaticThreadPool::cancel(TimerHandle handle) {
+    TimerTask task;
+    {
+        std::lock_guard lk(timer_m_);
+        task = timer_queue_.cancel(handle);
+    }
+
+    if (!task) {
+        return false;
+    }
+    task(false);
+    return true;
+}
+
+void StaticThreadPool::notify_timer_poller() {
+    // the poller checks state_ under timer_m_
+    { std::lock_guard lk(timer_m_); }
+    timer_cv_.notify_one();
+}
+
+void StaticThreadPool::post_bulk(Task* tasks, size_t n) {
+    if (n == 0) {
+        return;
+    }
+
+    constexpr size_t normal = (size_t)Priority::Normal;
+    uint64_t posted = stamp();
+    if (schedule_ == WorkStealing && local_pool_ == this) {
+        auto& worker = workers_[local_index_];
+        size_t depth = worker.tasks[normal].push_bulk(tasks, n, [posted](Task&& task) {
+            return Job{std::move(task), posted};
+        });
+        if (posted != 0) {
+            worker.metrics.local_depth_max.max(depth);
+        }
+    } else {
+        auto& injected = groups_[local_group()]->injected[normal];
+        size_t i = 0;
+        for (; i < n; ++i) {
+            Job job{std::move(tasks[i]), posted};
+            if (!injected.try_push(std::move(job))) {
+                // a full ring leaves job as it was, give the task back for the overflow
+                tasks[i] = std::move(job.task);
+                break;
+            }
+        }
+
+        if (i < n) {
+            std::lock_guard lk(mutex_);
+            for (size_t j = i; j < n; ++j) {
+                overflow_[normal].push_back({std::move(tasks[j]), posted});
+            }
+            overflow_size_.fetch_add(n - i, std::memory_order_relaxed);
+        }
+    }
+
+    notify_parked(n);
+}
+
+void StaticThreadPool::notify_parked(size_t n) {
+    // pairs with the fence in park(): either the parking worker
+    // sees the new task or we see it in parked_
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t parked = parked_.load(std::memory_order_relaxed);
+    if (parked == 0) {
+        return;
+    }
+
+    { std::lock_guard lk(mutex_); }
+    if (n >= parked) {
+        cv_.notify_all();
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            cv_.notify_one();
+        }
     }
-    cv_.notify_one();
 }
 
-void StaticThreadPool::run_in_background() {
-    std::function<void()> task;
+void StaticThreadPool::run_in_background(size_t index) {
+    local_pool_ = this;
+    local_index_ = index;
+    current_ = this;
+
+    auto& cpus = workers_[index].cpus;
+    if (!cpus.empty() && !pin_current_thread(cpus)) {
+        M_WARN("worker {} can't be pinned to its cpus", index);
+    }
+
+    auto& metrics = workers_[index].metrics;
+    // when the last task finished, 0 if the metrics were off
+    uint64_t idle_since = 0;
+
     for (; ;) {
-        {
-            std::unique_lock lk(mutex_);
-            
-            cv_.wait(lk, [this] {
-                return (state_ == Running && !tasks_.empty()) || state_ == PendingDestroy;
-            });
-            
-            if (state_ == PendingDestroy) {
-                M_TRACE("{}", "one thraad function quit");
-                return;
+        if (state_ == PendingDestroy) {
+            M_TRACE("{}", "one thraad function quit");
+            return;
+        }
+
+        auto job = next_task(index);
+        if (!job) {
+            uint64_t park_begin = stamp();
+            park();
+            if (park_begin != 0) {
+                metrics.parks.add(1);
+                metrics.park_ns.add(detail::metrics_now() - park_begin);
             }
+            continue;
+        }
 
-            task = std::move(tasks_.front());
-            tasks_.pop_front();
+        uint64_t begin = stamp();
+        if (begin != 0) {
+            if (job->posted != 0) {
+                metrics.wait.record(begin - job->posted);
+            }
+            if (idle_since != 0) {
+                metrics.idle_ns.add(begin - idle_since);
+            }
         }
 
         try {
-            task();
+            job->task();
         } catch(...) {
             M_FATAL("{}", "Throw exception when thread function is running");
         }
+
+        idle_since = 0;
+        if (begin != 0) {
+            idle_since = detail::metrics_now();
+            metrics.run.record(idle_since - begin);
+            metrics.tasks.add(1);
+        }
+    }
+}
+
+void StaticThreadPool::enable_metrics(bool enable) {
+    metrics_enabled_.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t StaticThreadPool::stamp() const {
+#if MAGIO_EXECUTOR_METRICS
+    if (metrics_enabled_.load(std::memory_order_relaxed)) {
+        return detail::metrics_now();
+    }
+#endif
+    return 0;
+}
+
+ExecutorMetrics StaticThreadPool::metrics() const {
+    ExecutorMetrics res;
+    res.tasks_per_worker.reserve(workers_.size());
+    for (auto& worker : workers_) {
+        auto& metrics = worker.metrics;
+        uint64_t tasks = metrics.tasks.get();
+        res.tasks += tasks;
+        res.tasks_per_worker.push_back(tasks);
+        metrics.wait.read(res.wait);
+        metrics.run.read(res.run);
+        res.idle_ns += metrics.idle_ns.get();
+        res.park_ns += metrics.park_ns.get();
+        res.parks += metrics.parks.get();
+        res.local_depth_max = std::max(res.local_depth_max, metrics.local_depth_max.get());
+        res.inject_depth_max = std::max(res.inject_depth_max, metrics.inject_depth_max.get());
+    }
+    timer_lateness_.read(res.timer_lateness);
+    return res;
+}
+
+size_t StaticThreadPool::local_group() const {
+    if (local_pool_ == this) {
+        return workers_[local_index_].group;
+    }
+
+    if (groups_.size() > 1) {
+        int cpu = current_cpu();
+        if (cpu >= 0 && (size_t)cpu < cpu_group_.size() && cpu_group_[cpu] >= 0) {
+            return cpu_group_[cpu];
+        }
+    }
+    return 0;
+}
+
+std::optional<StaticThreadPool::Job> StaticThreadPool::next_task(size_t index) {
+    constexpr size_t high = (size_t)Priority::High;
+    constexpr size_t normal = (size_t)Priority::Normal;
+    constexpr size_t low = (size_t)Priority::Low;
+    static constexpr size_t orders[][kPriorityLanes] = {
+        {high, normal, low},
+        {normal, high, low},
+        {low, high, normal}
+    };
+
+    size_t picks = workers_[index].picks++;
+    auto& order = picks % kLowAging == 0 ? orders[2] : picks % kNormalAging == 0 ? orders[1] : orders[0];
+
+    for (size_t lane : order) {
+        if (lane != normal && lane_size_[lane].load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        if (auto job = take(index, lane)) {
+            if (lane != normal) {
+                lane_size_[lane].fetch_sub(1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<StaticThreadPool::Job> StaticThreadPool::take(size_t index, size_t lane) {
+    auto& group = *groups_[workers_[index].group];
+
+    if (schedule_ == WorkStealing) {
+        if (auto job = workers_[index].tasks[lane].pop()) {
+            return job;
+        }
+    }
+
+    Job injected;
+    if (group.injected[lane].try_pop(injected)) {
+        // the depth it had when this job was still in it
+        if (injected.posted != 0) {
+            workers_[index].metrics.inject_depth_max.max(group.injected[lane].size() + 1);
+        }
+        return injected;
+    }
+
+    if (overflow_size_.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard lk(mutex_);
+        if (!overflow_[lane].empty()) {
+            std::optional<Job> job(std::move(overflow_[lane].front()));
+            overflow_[lane].pop_front();
+            overflow_size_.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    // the own group first, its tasks are likely still in this node's caches
+    size_t group_size = group.end - group.begin;
+    if (schedule_ == WorkStealing) {
+        for (size_t i = 1; i < group_size; ++i) {
+            size_t victim = group.begin + (index - group.begin + i) % group_size;
+            if (auto job = workers_[victim].tasks[lane].steal()) {
+                return job;
+            }
+        }
+    }
+
+    if (groups_.size() == 1) {
+        return std::nullopt;
+    }
+
+    for (size_t i = 1; i < groups_.size(); ++i) {
+        auto& other = *groups_[(workers_[index].group + i) % groups_.size()];
+        if (other.injected[lane].try_pop(injected)) {
+            return injected;
+        }
+    }
+
+    if (schedule_ == WorkStealing) {
+        // the groups are contiguous, the others follow group.end
+        size_t others = workers_.size() - group_size;
+        for (size_t i = 0; i < others; ++i) {
+            size_t victim = (group.end + (index + i) % others) % workers_.size();
+            if (auto job = workers_[victim].tasks[lane].steal()) {
+                return job;
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+void StaticThreadPool::park() {
+    std::unique_lock lk(mutex_);
+    parked_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(lk, [this] {
+        return (state_ == Running && has_task()) || state_ == PendingDestroy;
+    });
+    parked_.fetch_sub(1);
+}
+
+bool StaticThreadPool::has_task() {
+    for (size_t lane = 0; lane < kPriorityLanes; ++lane) {
+        if (!overflow_[lane].empty()) {
+            return true;
+        }
+
+        for (auto& group : groups_) {
+            if (!group->injected[lane].empty()) {
+                return true;
+            }
+        }
+
+        if (schedule_ == WorkStealing) {
+            for (auto& worker : workers_) {
+                if (!worker.tasks[lane].empty()) {
+                    return true;
+                }
+            }
+        }
     }
+
+    return false;
 }
 
 void StaticThreadPool::poll_timer_queue() {
-    std::vector<std::function<void(bool)>> expireds;
+    std::vector<TimerTask> expireds;
+    std::unique_lock lk(timer_m_);
+    // what the poller last slept until, the lateness counts once per wakeup
+    auto due = TimerClock::time_point::max();
 
     for (; ;) {
-        expireds.clear();
-        
-        {
-            std::unique_lock lk(timer_m_);
-
-            timer_cv_.wait(lk, [this] {
-                return (state_ == Running && !timer_queue_.empty()) || state_ == PendingDestroy;
-            });
-
-            if (state_ == PendingDestroy) {
-                M_TRACE("{}", "timer poller unction quit");
-                return;
+        if (state_ == PendingDestroy) {
+            M_TRACE("{}", "timer poller unction quit");
+            return;
+        }
+
+        timer_queue_.get_expired(expireds);
+        if (!expireds.empty()) {
+            if (due != TimerClock::time_point::max() && stamp() != 0) {
+                auto late = std::max(TimerClock::now() - due, TimerClock::duration::zero());
+                timer_lateness_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(late).count());
             }
-            
-            timer_queue_.get_expired(expireds);
+            due = TimerClock::time_point::max();
+            lk.unlock();
+            dispatch_expired(expireds);
+            lk.lock();
+            continue;
         }
 
-        for (auto& task : expireds) {
-            task(true);
+        // sleeps until the earliest deadline, expires_until()
+        // only wakes us for a timer due before that
+        if (auto next = timer_queue_.next_expiry()) {
+            poller_deadline_ = *next;
+            timer_cv_.wait_until(lk, *next);
+        } else {
+            poller_deadline_ = TimerClock::time_point::max();
+            timer_cv_.wait(lk);
         }
+        // a timer due sooner may have moved it while we slept
+        due = poller_deadline_;
+    }
+}
+
+void StaticThreadPool::dispatch_expired(std::vector<TimerTask>& expireds) {
+    // one task per worker at most, so a slow callback
+    // holds back only the timers of its own batch
+    size_t batches = std::min(expireds.size(), workers_.size());
+    size_t batch_size = (expireds.size() + batches - 1) / batches;
+
+    std::vector<Task> tasks;
+    tasks.reserve(batches);
+    for (size_t begin = 0; begin < expireds.size(); begin += batch_size) {
+        auto end = std::min(begin + batch_size, expireds.size());
+        std::vector<TimerTask> batch(
+            std::make_move_iterator(expireds.begin() + begin),
+            std::make_move_iterator(expireds.begin() + end));
+
+        tasks.emplace_back([batch = std::move(batch)]() mutable {
+            for (auto& task : batch) {
+                task(true);
+            }
+        });
     }
+    expireds.clear();
+    post_bulk(tasks);
 }
 
 }
\ No newline at end of file
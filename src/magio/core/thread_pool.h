@@ -2,16 +2,52 @@
 #define MAGIO_CORE_THREAD_POOL_H_
 
 #include <deque>
+#include <memory>
+#include <vector>
+#include <optional>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 
 #include "magio/core/executor.h"
+#include "magio/core/topology.h"
+#include "magio/core/mpmc_queue.h"
 #include "magio/core/timer_queue.h"
 #include "magio/core/noncopyable.h"
+#include "magio/core/executor_metrics.h"
+#include "magio/core/work_stealing_queue.h"
 
 namespace magio {
 
+constexpr size_t kInjectQueueSize = 1 << 14;
+
+// Aging of the priority lanes: every kNormalAging-th pick of a worker
+// looks at Normal before High, every kLowAging-th at Low first, so a
+// steady stream of High tasks slows the lower lanes down but never stops them
+constexpr size_t kNormalAging = 8;
+constexpr size_t kLowAging = 32;
+
+// Where the workers run. Every group gets its own shared queue, the workers
+// are spread evenly over the groups, pinned to their group's cpus, and look
+// for tasks in their own group before the others. Posts from a worker go to
+// its group, posts from other threads to the group of the cpu they run on.
+// No groups is one group left to the OS
+struct Placement {
+    std::vector<CpuSet> groups;
+    // pins each worker to a single cpu of its group, round robin
+    bool pin_to_cpu = false;
+
+    // a group per NUMA node
+    static Placement numa() {
+        return {numa_nodes()};
+    }
+
+    // one group, a worker per cpu
+    static Placement pinned(CpuSet cpus) {
+        return {{std::move(cpus)}, true};
+    }
+};
+
 class StaticThreadPool final: Noncopyable, public Executor {
 public:
     enum State {
@@ -20,10 +56,20 @@ public:
         PendingDestroy
     };
 
-    StaticThreadPool(size_t thread_num)
-        : threads_(thread_num + 1) 
+    enum Schedule {
+        // every task goes through the shared queue
+        Global,
+        // tasks posted from a worker stay in its local queue,
+        // idle workers steal from the others
+        WorkStealing
+    };
+
+    StaticThreadPool(size_t thread_num, Schedule schedule = WorkStealing)
+        : StaticThreadPool(thread_num, Placement{}, schedule)
     { }
 
+    StaticThreadPool(size_t thread_num, Placement placement, Schedule schedule = WorkStealing);
+
     ~StaticThreadPool();
 
     void start();
@@ -40,41 +86,122 @@ public:
 
     void destroy();
 
-    void post(std::function<void()>&& task) override;
+    void post(Task&& task) override;
 
-    template<typename Rep, typename Per>
-    void expires_after(const std::chrono::duration<Rep, Per>& dur, std::function<void(bool)>&& task) {
-        {
-            std::lock_guard lk(timer_m_);
-            timer_queue_.push(TimerClock::now() + dur, std::move(task));
-        }
-        timer_cv_.notify_one();
-    }
+    void post(Task&& task, Priority priority) override;
 
-    void expires_until(const TimerClock::time_point& tp, std::function<void(bool)>&& task) {
-        {
-            std::lock_guard lk(timer_m_);
-            timer_queue_.push(tp, std::move(task));
-        }
-        timer_cv_.notify_one();
-    }
+    // always in the Normal lane
+    using Executor::post_bulk;
+
+    void post_bulk(Task* tasks, size_t n) override;
+
+    TimerHandle expires_until(const TimerClock::time_point& tp, TimerTask&& task) override;
+
+    bool cancel(TimerHandle handle) override;
+
+    // Off by default. Tasks posted while it is off don't count toward the
+    // wait histogram, and metrics() reads zeros if MAGIO_EXECUTOR_METRICS is 0
+    void enable_metrics(bool enable);
+
+    // sums what each worker has recorded so far, without stopping them
+    ExecutorMetrics metrics() const;
 
 private:
-    void run_in_background();
+    // a task and when it was posted, 0 while the metrics are off
+    struct Job {
+        Task task;
+        uint64_t posted = 0;
+    };
+
+    struct alignas(64) Worker {
+        WorkStealingQueue<Job> tasks[kPriorityLanes];
+        // counts next_task() calls, drives the aging
+        size_t picks = 1;
+        size_t group = 0;
+        // empty leaves the thread to the OS
+        CpuSet cpus;
+        // written by this worker only
+        detail::WorkerMetrics metrics;
+    };
+
+    struct Group {
+        static_assert(kPriorityLanes == 3);
+
+        explicit Group(CpuSet cpus)
+            : injected{kInjectQueueSize, kInjectQueueSize, kInjectQueueSize}
+            , cpus(std::move(cpus)) { }
+
+        // posts from threads outside the group, a queue per lane
+        MpmcQueue<Job> injected[kPriorityLanes];
+        CpuSet cpus;
+        // its workers, [begin, end)
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void run_in_background(size_t index);
+
+    // the group a post from the calling thread goes to
+    size_t local_group() const;
+
+    std::optional<Job> next_task(size_t index);
+
+    // next_task() in one lane
+    std::optional<Job> take(size_t index, size_t lane);
+
+    // now for the metrics, 0 while they are off
+    uint64_t stamp() const;
+
+    void park();
+
+    bool has_task();
+
+    // wakes up to n parked workers
+    void notify_parked(size_t n = 1);
+
+    void notify_timer_poller();
 
     void poll_timer_queue();
 
+    void dispatch_expired(std::vector<TimerTask>& expireds);
+
+    inline static thread_local StaticThreadPool* local_pool_ = nullptr;
+    inline static thread_local size_t local_index_ = 0;
+
     std::once_flag once_f_;
 
     std::atomic<State> state_ = NotStarted;
+    Schedule schedule_;
+
+    std::vector<std::unique_ptr<Group>> groups_;
+    // group of each cpu, -1 for cpus outside every group
+    std::vector<int> cpu_group_;
 
+    // tasks in the High and Low lanes, so workers skip them when they are
+    // empty. Normal isn't counted, its posts stay off a shared counter
+    std::atomic_size_t lane_size_[kPriorityLanes] = {};
+
+    // takes the posts that don't fit in the groups' queues
+    // while the workers are behind
+    std::deque<Job> overflow_[kPriorityLanes];
+    std::atomic_size_t overflow_size_ = 0;
+
+    // guards overflow_ and parking
     std::mutex mutex_;
     std::condition_variable cv_;
-    std::deque<std::function<void()>> tasks_;
+    std::atomic_size_t parked_ = 0;
+
+    std::vector<Worker> workers_;
 
     std::mutex timer_m_;
     std::condition_variable timer_cv_;
     TimerQueue timer_queue_;
+    // when the poller wakes up next, a timer due earlier has to notify it
+    TimerClock::time_point poller_deadline_ = TimerClock::time_point::max();
+
+    std::atomic_bool metrics_enabled_ = false;
+    // written by the poller only
+    detail::Histogram timer_lateness_;
 
     std::vector<std::thread> threads_;
     std::thread timer_poller_thread_;
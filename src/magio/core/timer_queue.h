@@ -1,66 +1,268 @@
 #ifndef MAGIO_CORE_TIMER_QUEUE_H
 #define MAGIO_CORE_TIMER_QUEUE_H
 
-#include <queue>
-#include <atomic>
-#include <memory>
+#include <array>
+#include <vector>
 #include <chrono>
-#include <functional>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
 
-#include "magio/core/logger.h"
+#include "magio/core/task.h"
+#include "magio/core/executor.h"
 
 namespace magio {
 
-using TimerClock = std::chrono::steady_clock;
+// resolution of the wheel, deadlines are rounded up to whole ticks
+using TimerTick = std::chrono::milliseconds;
 
-struct TimerData {
-    TimerData(TimerClock::time_point tp, std::function<void(bool)>&& f)
-        : dead_line(tp), task(std::move(f)) 
-    { }
+constexpr size_t kTimerWheelBits = 6;
+constexpr size_t kTimerWheelSlots = 1 << kTimerWheelBits;
+// 5 levels of 64 slots span 2^30 ticks (about 12 days), later
+// timers wait in the last level and are cascaded into it again
+constexpr size_t kTimerWheelLevels = 5;
 
-    TimerClock::time_point dead_line;
-    std::function<void(bool)> task;
-};
+// Hierarchical timing wheel. Each slot of level l spans 64^l ticks, a timer
+// is linked into the lowest level that reaches its deadline and moves down
+// when the wheel turns over its slot. Nodes live in one vector and link to
+// each other by index, so insert and cancel are O(1) and a handle is a node
+// index checked against the node's generation
+class TimerQueue {
+public:
+    TimerQueue()
+        : start_(TimerClock::now())
+    {
+        for (auto& level : slots_) {
+            level.fill(kNil);
+        }
+    }
+
+    TimerHandle push(const TimerClock::time_point& tp, TimerTask&& task) {
+        uint32_t index;
+        if (free_ != kNil) {
+            index = free_;
+            free_ = nodes_[index].next;
+        } else {
+            index = (uint32_t)nodes_.size();
+            nodes_.emplace_back();
+        }
 
-struct TimerCompare {
-    bool operator()(
-        const TimerData& left, 
-        const TimerData& right
-    ) const {
-        return left.dead_line < right.dead_line;
+        auto& node = nodes_[index];
+        node.task = std::move(task);
+        node.expiry = to_tick(tp);
+        link(index);
+        ++size_;
+
+        return TimerHandle(index, node.generation);
     }
-};
 
-class TimerQueue {
-    using QueueType = std::priority_queue<
-        TimerData,
-        std::vector<TimerData>,
-        TimerCompare
-    >;
+    // takes the task of a pending timer out of the wheel,
+    // empty if the timer has already fired or been cancelled
+    TimerTask cancel(TimerHandle handle) {
+        if (!handle || handle.index_ >= nodes_.size()
+            || nodes_[handle.index_].generation != handle.generation_) {
+            return nullptr;
+        }
 
-public:
-    bool get_expired(std::vector<std::function<void(bool)>>& res) {
-        auto current_tp = TimerClock::now();
+        unlink(handle.index_);
+        auto task = std::move(nodes_[handle.index_].task);
+        release(handle.index_);
+        return task;
+    }
+
+    bool get_expired(std::vector<TimerTask>& res) {
+        auto target = (uint64_t)std::chrono::floor<TimerTick>(TimerClock::now() - start_).count();
 
-        for (; !timers_.empty() && current_tp >= timers_.top().dead_line;) {
-            res.push_back(std::move(const_cast<std::function<void(bool)>&>(timers_.top().task)));
-            timers_.pop();
+        while (next_ <= target) {
+            if (size_ == 0) {
+                next_ = target + 1;
+                break;
+            }
+
+            size_t index = next_ & kSlotMask;
+            if (index == 0) {
+                cascade();
+            }
+
+            uint64_t occupied = occupied_[0] >> index;
+            if (occupied == 0) {
+                // nothing left in this turn of level 0
+                next_ = std::min((next_ | kSlotMask) + 1, target + 1);
+                continue;
+            }
+
+            uint64_t tick = next_ + count_trailing_zeros(occupied);
+            if (tick > target) {
+                next_ = target + 1;
+                break;
+            }
+
+            expire(tick & kSlotMask, res);
+            next_ = tick + 1;
         }
 
         return !res.empty();
     }
 
-    void push(const TimerClock::time_point& tp, std::function<void(bool)>&& task) {
-        timers_.emplace(tp, std::move(task));
+    // The earliest time get_expired() may have work to do, exact for timers
+    // due within the current turn of level 0 and earlier for the others,
+    // which need a cascade first
+    std::optional<TimerClock::time_point> next_expiry() const {
+        if (size_ == 0) {
+            return std::nullopt;
+        }
+
+        uint64_t earliest = UINT64_MAX;
+        for (size_t level = 0; level < kTimerWheelLevels; ++level) {
+            if (occupied_[level] == 0) {
+                continue;
+            }
+
+            size_t shift = kTimerWheelBits * level;
+            uint64_t span = uint64_t(1) << shift;
+            // the first tick at or after next_ where this level turns
+            uint64_t turn = (next_ + span - 1) & ~(span - 1);
+            size_t index = (turn >> shift) & kSlotMask;
+            uint64_t occupied = index == 0
+                ? occupied_[level]
+                : (occupied_[level] >> index) | (occupied_[level] << (kTimerWheelSlots - index));
+            earliest = std::min(earliest, turn + count_trailing_zeros(occupied) * span);
+        }
+
+        return start_ + TimerTick(earliest);
+    }
+
+    bool empty() const {
+        return size_ == 0;
     }
 
-    size_t empty() {
-        return timers_.empty();
+    size_t size() const {
+        return size_;
     }
 
 private:
-    QueueType timers_;
+    static constexpr uint32_t kNil = UINT32_MAX;
+    static constexpr uint64_t kSlotMask = kTimerWheelSlots - 1;
+    static constexpr uint64_t kMaxDelta = (uint64_t(1) << (kTimerWheelBits * kTimerWheelLevels)) - 1;
+
+    struct Node {
+        TimerTask task;
+        uint64_t expiry = 0;
+        uint32_t prev = kNil;
+        // also links the free list
+        uint32_t next = kNil;
+        // bumped each time the node is released, 0 is never used
+        uint32_t generation = 1;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+    };
+
+    static size_t count_trailing_zeros(uint64_t bits) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(bits);
+#else
+        size_t n = 0;
+        for (; !(bits & 1); bits >>= 1) {
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    uint64_t to_tick(const TimerClock::time_point& tp) const {
+        if (tp <= start_) {
+            return 0;
+        }
+        return (uint64_t)std::chrono::ceil<TimerTick>(tp - start_).count();
+    }
+
+    void link(uint32_t index) {
+        auto& node = nodes_[index];
+        // a deadline that has passed fires with the next tick
+        uint64_t delta = std::min(std::max(node.expiry, next_) - next_, kMaxDelta);
+
+        size_t level = 0;
+        while (level + 1 < kTimerWheelLevels && delta >> (kTimerWheelBits * (level + 1))) {
+            ++level;
+        }
+        size_t slot = ((next_ + delta) >> (kTimerWheelBits * level)) & kSlotMask;
+
+        node.level = (uint8_t)level;
+        node.slot = (uint8_t)slot;
+        node.prev = kNil;
+        node.next = slots_[level][slot];
+        if (node.next != kNil) {
+            nodes_[node.next].prev = index;
+        }
+        slots_[level][slot] = index;
+        occupied_[level] |= uint64_t(1) << slot;
+    }
+
+    void unlink(uint32_t index) {
+        auto& node = nodes_[index];
+        if (node.prev != kNil) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            slots_[node.level][node.slot] = node.next;
+            if (node.next == kNil) {
+                occupied_[node.level] &= ~(uint64_t(1) << node.slot);
+            }
+        }
+        if (node.next != kNil) {
+            nodes_[node.next].prev = node.prev;
+        }
+    }
+
+    void release(uint32_t index) {
+        auto& node = nodes_[index];
+        node.task.reset();
+        if (++node.generation == 0) {
+            node.generation = 1;
+        }
+        node.next = free_;
+        free_ = index;
+        --size_;
+    }
+
+    uint32_t take_slot(size_t level, size_t slot) {
+        occupied_[level] &= ~(uint64_t(1) << slot);
+        return std::exchange(slots_[level][slot], kNil);
+    }
+
+    // next_ is at a turn of level 0, moves the timers of the slots
+    // the upper levels have reached down to where they now belong
+    void cascade() {
+        for (size_t level = 1; level < kTimerWheelLevels; ++level) {
+            size_t slot = (next_ >> (kTimerWheelBits * level)) & kSlotMask;
+            for (auto index = take_slot(level, slot); index != kNil; ) {
+                link(std::exchange(index, nodes_[index].next));
+            }
+
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+
+    void expire(size_t slot, std::vector<TimerTask>& res) {
+        for (auto index = take_slot(0, slot); index != kNil; ) {
+            auto next = nodes_[index].next;
+            res.push_back(std::move(nodes_[index].task));
+            release(index);
+            index = next;
+        }
+    }
+
+    TimerClock::time_point start_;
+    // the next tick get_expired() has to process
+    uint64_t next_ = 0;
+    size_t size_ = 0;
+    uint32_t free_ = kNil;
 
+    std::vector<Node> nodes_;
+    std::array<std::array<uint32_t, kTimerWheelSlots>, kTimerWheelLevels> slots_;
+    // a bit per non-empty slot
+    std::array<uint64_t, kTimerWheelLevels> occupied_{};
 };
 
 }
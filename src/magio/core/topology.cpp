@@ -0,0 +1,100 @@
+#include "magio/core/topology.h"
+
+#include <string>
+#include <thread>
+#include <fstream>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+namespace magio {
+
+namespace {
+
+// parses a cpulist like "0-3,8-11"
+CpuSet parse_cpu_list(const std::string& list) {
+    CpuSet cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        auto range = list.substr(pos, end - pos);
+        auto dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (...) {
+            // blank or garbled, skipped
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+std::vector<CpuSet> detect_numa_nodes() {
+    std::vector<CpuSet> nodes;
+    for (int node = 0; ; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in) {
+            break;
+        }
+
+        std::string list;
+        std::getline(in, list);
+        auto cpus = parse_cpu_list(list);
+        // memory only nodes have no cpus to run workers on
+        if (!cpus.empty()) {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+
+    if (nodes.empty()) {
+        CpuSet cpus;
+        for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency(); ++cpu) {
+            cpus.push_back(cpu);
+        }
+        nodes.push_back(std::move(cpus));
+    }
+    return nodes;
+}
+
+}
+
+const std::vector<CpuSet>& numa_nodes() {
+    static const std::vector<CpuSet> nodes = detect_numa_nodes();
+    return nodes;
+}
+
+int current_cpu() {
+#if defined(__linux__)
+    return ::sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+bool pin_current_thread(const CpuSet& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef MAGIO_CORE_TOPOLOGY_H_
+#define MAGIO_CORE_TOPOLOGY_H_
+
+#include <vector>
+
+namespace magio {
+
+// cpu numbers as the OS counts them
+using CpuSet = std::vector<int>;
+
+// The cpus of each NUMA node, read once from /sys/devices/system/node.
+// One node with every cpu where that is not available
+const std::vector<CpuSet>& numa_nodes();
+
+// the cpu the calling thread runs on, -1 if unknown
+int current_cpu();
+
+// restricts the calling thread to cpus, false if the OS refused
+bool pin_current_thread(const CpuSet& cpus);
+
+}
+
+#endif
\ No newline at end of file
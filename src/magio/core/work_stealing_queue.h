@@ -0,0 +1,73 @@
+#ifndef MAGIO_CORE_WORK_STEALING_QUEUE_H_
+#define MAGIO_CORE_WORK_STEALING_QUEUE_H_
+
+#include <deque>
+#include <mutex>
+#include <optional>
+
+#include "magio/core/noncopyable.h"
+
+namespace magio {
+
+// Per worker queue. The owner pushes and pops at the back (LIFO),
+// idle workers steal from the front (FIFO), so the lock is only
+// contended when a thief meets the owner on the same queue
+template<typename T>
+class WorkStealingQueue: Noncopyable {
+public:
+    // returns the size after the push
+    size_t push(T&& task) {
+        std::lock_guard lk(mutex_);
+        tasks_.push_back(std::move(task));
+        return tasks_.size();
+    }
+
+    // moves items[0, n) in with one lock, each made into a T by make
+    template<typename U, typename Make>
+    size_t push_bulk(U* items, size_t n, Make&& make) {
+        std::lock_guard lk(mutex_);
+        for (size_t i = 0; i < n; ++i) {
+            tasks_.push_back(make(std::move(items[i])));
+        }
+        return tasks_.size();
+    }
+
+    size_t push_bulk(T* items, size_t n) {
+        return push_bulk(items, n, [](T&& item) -> T&& { return std::move(item); });
+    }
+
+    std::optional<T> pop() {
+        std::lock_guard lk(mutex_);
+        if (tasks_.empty()) {
+            return std::nullopt;
+        }
+
+        std::optional<T> task(std::move(tasks_.back()));
+        tasks_.pop_back();
+        return task;
+    }
+
+    std::optional<T> steal() {
+        std::unique_lock lk(mutex_, std::try_to_lock);
+        if (!lk || tasks_.empty()) {
+            return std::nullopt;
+        }
+
+        std::optional<T> task(std::move(tasks_.front()));
+        tasks_.pop_front();
+        return task;
+    }
+
+    bool empty() {
+        std::lock_guard lk(mutex_);
+        return tasks_.empty();
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<T> tasks_;
+};
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include <mutex>
+#include <string>
+
+#include "test.h"
+
+#include "magio/core/logger.h"
+
+using namespace std;
+using namespace magio;
+
+class StringSink: public LogSink {
+public:
+    void write(string_view records) override {
+        lock_guard lk(m_);
+        text_ += records;
+    }
+
+    void flush() override { }
+
+    string take() {
+        lock_guard lk(m_);
+        return std::move(text_);
+    }
+
+private:
+    mutex m_;
+    string text_;
+};
+
+// a record longer than kSmallBufferSize comes out whole, with its newline
+void long_record(StringSink& sink) {
+    string text(6000, 'x');
+    M_INFO("<{}>", text);
+    M_INFO("{}", "next");
+    Logger::flush();
+
+    auto out = sink.take();
+    CHECK(out == "<" + text + ">\nnext\n");
+}
+
+int main() {
+    auto sink = make_shared<StringSink>();
+    Logger::add_sink(sink);
+    Logger::set_pattern(Logger::Off);
+
+    long_record(*sink);
+    Logger::set_async();
+    long_record(*sink);
+
+    fmt::print("ok\n");
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include <string>
+
+#include "test.h"
+
+#include "magio/core/static_buffer.h"
+
+using namespace std;
+using namespace magio;
+
+// a formatted record longer than the buffer is cut at the end of it
+void long_format() {
+    StaticBuffer<16> buf;
+    buf.append("abcd");
+
+    string text(6000, 'x');
+    CHECK(buf.append_format("{}", fmt::make_format_args(text)) == 12);
+    CHECK(buf.size() == 16);
+    CHECK(buf.rest() == 0);
+    CHECK(buf.str_view() == "abcd" + string(12, 'x'));
+
+    CHECK(buf.append("\n") == 0);
+    CHECK(buf.append_format("{}", fmt::make_format_args(text)) == 0);
+    CHECK(buf.size() == 16);
+}
+
+int main() {
+    long_format();
+    fmt::print("ok\n");
+}
\ No newline at end of file
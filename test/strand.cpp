@@ -0,0 +1,145 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+#include "magio/core/strand.h"
+#include "magio/core/promise.h"
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+#include "magio/core/loop_executor.h"
+#include "magio/core/cancellation.h"
+
+using namespace std;
+using namespace magio;
+using namespace chrono_literals;
+
+// tasks of one producer run in the order they were posted, post() and
+// post_bulk() mixed, also across the kStrandBudget handoffs of run()
+void fifo(Strand& strand) {
+    constexpr size_t n = kStrandBudget * 20;
+    vector<size_t> order;
+    WaitGroup wg(1);
+
+    for (size_t i = 0; i < n; ) {
+        if (i % 3 == 0) {
+            Task tasks[kStrandBudget + 1];
+            for (auto& task : tasks) {
+                task = [&order, i = i++] { order.push_back(i); };
+            }
+            strand.post_bulk(tasks);
+        } else {
+            strand.post([&order, i = i++] { order.push_back(i); });
+        }
+    }
+    strand.post([&] { wg.done(); });
+    wg.wait();
+
+    CHECK(order.size() >= n);
+    for (size_t i = 0; i < order.size(); ++i) {
+        CHECK(order[i] == i);
+    }
+}
+
+// with many producers no two tasks run at once and each
+// producer's tasks keep their order
+void exclusive(Strand& strand) {
+    constexpr size_t producers = 8;
+    constexpr size_t n = 10'000;
+    atomic_bool running = false;
+    vector<size_t> last(producers, 0);
+    WaitGroup wg(producers * n);
+
+    vector<thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (size_t i = 1; i <= n; ++i) {
+                strand.post([&, p, i] {
+                    CHECK(!running.exchange(true));
+                    CHECK(strand.running_in_this_thread());
+                    CHECK(last[p] + 1 == i);
+                    last[p] = i;
+                    running = false;
+                    wg.done();
+                });
+            }
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    wg.wait();
+}
+
+// cancel() doesn't wait for the strand, the task gets false on it later
+void cancel(Strand& strand) {
+    atomic_bool in_task = false;
+    WaitGroup started(1);
+    WaitGroup release(1);
+    strand.post([&] {
+        in_task = true;
+        started.done();
+        release.wait();
+        in_task = false;
+    });
+    started.wait();
+
+    WaitGroup called(1);
+    auto handle = strand.expires_after(1h, [&](bool expired) {
+        CHECK(!expired);
+        CHECK(strand.running_in_this_thread());
+        CHECK(!in_task);
+        called.done();
+    });
+
+    CHECK(strand.cancel(handle));
+    CHECK(!strand.cancel(handle));
+    release.done();
+    called.wait();
+}
+
+// A plain task of the only thread cancels the timer of a busy strand,
+// directly and through a token, which would hang if cancel() waited
+void cancel_on_loop() {
+    LoopExecutor loop;
+    Strand strand(&loop);
+    CancellationSource source;
+
+    bool cancelled = false;
+    bool rejected = false;
+    auto handle = strand.expires_after(1h, [&](bool expired) {
+        CHECK(!expired);
+        cancelled = true;
+    });
+    sleep_for(&strand, 1h, source.token())->fail([&] {
+        rejected = true;
+    });
+    loop.poll();
+
+    strand.post([] { });
+    loop.post([&] {
+        CHECK(strand.cancel(handle));
+        source.cancel();
+        CHECK(!cancelled);
+    });
+    loop.run_for(1s);
+
+    CHECK(cancelled);
+    CHECK(rejected);
+}
+
+int main() {
+    StaticThreadPool pool(4);
+    pool.start();
+    Strand strand(&pool);
+
+    fifo(strand);
+    exclusive(strand);
+    cancel(strand);
+    cancel_on_loop();
+
+    pool.destroy();
+    fmt::print("ok\n");
+}
\ No newline at end of file
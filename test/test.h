@@ -0,0 +1,18 @@
+#ifndef MAGIO_TEST_TEST_H_
+#define MAGIO_TEST_TEST_H_
+
+#include <cstdlib>
+
+#include "fmt/core.h"
+
+// Each test is a binary that exits non zero on the first failed check
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #cond); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+#endif
\ No newline at end of file
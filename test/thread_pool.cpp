@@ -0,0 +1,48 @@
+#include <atomic>
+#include <vector>
+
+#include "test.h"
+
+#include "magio/core/wait_group.h"
+#include "magio/core/thread_pool.h"
+
+using namespace std;
+using namespace magio;
+
+// more posts from outside the pool than its inject ring holds, the
+// rest go to the overflow queue and every task still runs once
+void overflow(bool bulk) {
+    constexpr size_t n = kInjectQueueSize + 10;
+    StaticThreadPool pool(4);
+
+    atomic_size_t ran = 0;
+    WaitGroup wg(n);
+    vector<Task> tasks;
+    tasks.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        tasks.emplace_back([&] {
+            ran.fetch_add(1, memory_order_relaxed);
+            wg.done();
+        });
+    }
+
+    // not started, so nothing drains the ring meanwhile
+    if (bulk) {
+        pool.post_bulk(tasks.data(), tasks.size());
+    } else {
+        for (auto& task : tasks) {
+            pool.post(std::move(task));
+        }
+    }
+
+    pool.start();
+    wg.wait();
+    CHECK(ran.load() == n);
+    pool.destroy();
+}
+
+int main() {
+    overflow(false);
+    overflow(true);
+    fmt::print("ok\n");
+}
\ No newline at end of file
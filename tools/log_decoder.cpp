@@ -0,0 +1,203 @@
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "fmt/args.h"
+#include "fmt/chrono.h"
+
+#include "magio/core/binary_logging.h"
+
+// Turns a file written by Logger::set_binary back into the text the
+// synchronous logger prints with the default pattern and microseconds
+//   log_decoder <file>
+
+using namespace std;
+using namespace magio;
+
+struct Site {
+    LogLevel level;
+    uint32_t line;
+    string file;
+    string format;
+    vector<binlog::ArgType> types;
+};
+
+class Reader {
+public:
+    Reader(const char* data, size_t size)
+        : p_(data), end_(data + size) { }
+
+    bool empty() const {
+        return p_ == end_;
+    }
+
+    template<typename T>
+    T get() {
+        T value{};
+        need(sizeof(value));
+        memcpy(&value, p_, sizeof(value));
+        p_ += sizeof(value);
+        return value;
+    }
+
+    string_view get_string() {
+        auto n = get<uint32_t>();
+        return get_bytes(n);
+    }
+
+    string_view get_bytes(size_t n) {
+        need(n);
+        string_view sv(p_, n);
+        p_ += n;
+        return sv;
+    }
+
+private:
+    void need(size_t n) {
+        if ((size_t)(end_ - p_) < n) {
+            throw runtime_error("truncated log file");
+        }
+    }
+
+    const char* p_;
+    const char* end_;
+};
+
+constexpr string_view kLevelNames[] = {
+    "", "trace", "debug", "info", "warn", "error", "fatal"
+};
+
+void print_record(const Site& site, const string& thread, uint64_t ns, Reader& args) {
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    for (auto type : site.types) {
+        switch (type) {
+        case binlog::Int:
+            store.push_back(args.get<int64_t>());
+            break;
+        case binlog::Uint:
+            store.push_back(args.get<uint64_t>());
+            break;
+        case binlog::Double:
+            store.push_back(args.get<double>());
+            break;
+        case binlog::Float:
+            store.push_back(args.get<float>());
+            break;
+        case binlog::Bool:
+            store.push_back(args.get<bool>());
+            break;
+        case binlog::Char:
+            store.push_back(args.get<char>());
+            break;
+        case binlog::String:
+            store.push_back(string(args.get_string()));
+            break;
+        default:
+            throw runtime_error("unknown argument type");
+        }
+    }
+
+    string msg;
+    try {
+        msg = fmt::vformat(site.format, store);
+    } catch (const fmt::format_error& e) {
+        msg = fmt::format("<{}: {}>", e.what(), site.format);
+    }
+
+    auto second = (time_t)(ns / 1000000000);
+    auto us = ns / 1000 % 1000000;
+    fmt::print("{} {:%Y-%m-%d %H:%M:%S}.{:06} f:{} l:{} id:{} {}\n",
+        kLevelNames[(int)site.level], fmt::localtime(second), us,
+        site.file, site.line, thread, msg);
+}
+
+void decode(Reader& reader) {
+    unordered_map<uint32_t, Site> sites;
+    unordered_map<uint32_t, string> threads;
+
+    if (reader.get_bytes(sizeof(binlog::kMagic)) != string_view(binlog::kMagic, sizeof(binlog::kMagic))) {
+        throw runtime_error("not a magio binary log");
+    }
+
+    while (!reader.empty()) {
+        switch (reader.get<char>()) {
+        case binlog::SiteTag: {
+            auto id = reader.get<uint32_t>();
+            auto& site = sites[id];
+            site.level = (LogLevel)reader.get<uint8_t>();
+            site.line = reader.get<uint32_t>();
+            site.file = reader.get_string();
+            site.format = reader.get_string();
+            site.types.resize(reader.get<uint8_t>());
+            for (auto& type : site.types) {
+                type = (binlog::ArgType)reader.get<uint8_t>();
+            }
+            break;
+        }
+        case binlog::ThreadTag: {
+            auto index = reader.get<uint32_t>();
+            threads[index] = reader.get_string();
+            break;
+        }
+        case binlog::BlockTag: {
+            auto& thread = threads[reader.get<uint32_t>()];
+            auto bytes = reader.get_bytes(reader.get<uint32_t>());
+            Reader block(bytes.data(), bytes.size());
+
+            while (!block.empty()) {
+                auto size = block.get<uint32_t>();
+                if (size < binlog::kRecordHeaderSize) {
+                    throw runtime_error("corrupted record");
+                }
+                auto site_id = block.get<uint32_t>();
+                auto ns = block.get<uint64_t>();
+                auto body = block.get_bytes(size - binlog::kRecordHeaderSize);
+
+                auto it = sites.find(site_id);
+                if (it == sites.end()) {
+                    throw runtime_error("record of an unknown site");
+                }
+                Reader args(body.data(), body.size());
+                print_record(it->second, thread, ns, args);
+            }
+            break;
+        }
+        case binlog::DroppedTag: {
+            auto& thread = threads[reader.get<uint32_t>()];
+            auto count = reader.get<uint64_t>();
+            fmt::print("{} log records dropped on thread {}\n", count, thread);
+            break;
+        }
+        default:
+            throw runtime_error("unknown entry");
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fmt::print(stderr, "usage: {} <file>\n", argv[0]);
+        return 1;
+    }
+
+    ifstream in(argv[1], ios::binary);
+    if (!in) {
+        fmt::print(stderr, "can't open {}\n", argv[1]);
+        return 1;
+    }
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    try {
+        Reader reader(data.data(), data.size());
+        decode(reader);
+    } catch (const exception& e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 1;
+    }
+}
\ No newline at end of file
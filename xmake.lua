@@ -2,10 +2,27 @@
 
 set_toolchains("gcc")
 
-set_languages("c++17")
+-- xmake f --coroutine=y builds with c++20 and enables magio/core/coroutine.h
+option("coroutine")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build with C++20 coroutine support")
+option_end()
+
+if has_config("coroutine") then
+    set_languages("c++20")
+else
+    set_languages("c++17")
+end
 set_warnings("all")
 
 add_rules("mode.debug", "mode.release")
+
+-- M_TRACE and M_DEBUG compile to nothing in release builds,
+-- see MAGIO_LOG_MIN_LEVEL in magio/core/logger.h
+if is_mode("release") then
+    add_defines("MAGIO_LOG_MIN_LEVEL=3")
+end
 add_requires("fmt")
 
 
@@ -48,7 +65,40 @@ function build_examples()
     end
 end
 
+function build_bench() 
+    for _, val in ipairs(os.files("bench/**.cpp")) do 
+        target(path.basename(val))
+            set_kind("binary")
+            add_files(val)
+            add_deps("magio-promise")
+            add_packages("fmt")
+    end
+end
+
+function build_tools()
+    for _, val in ipairs(os.files("tools/**.cpp")) do 
+        target(path.basename(val))
+            set_kind("binary")
+            add_files(val)
+            add_deps("magio-promise")
+            add_packages("fmt")
+    end
+end
+
+function build_tests()
+    for _, val in ipairs(os.files("test/**.cpp")) do 
+        target("test_" .. path.basename(val))
+            set_kind("binary")
+            add_files(val)
+            add_deps("magio-promise")
+            add_packages("fmt")
+    end
+end
+
 use_asan()
 --build_dev()
 build_magio_promise()
-build_examples()
\ No newline at end of file
+build_examples()
+build_bench()
+build_tools()
+build_tests()
\ No newline at end of file